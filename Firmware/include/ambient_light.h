@@ -0,0 +1,90 @@
+#ifndef __AMBIENT_LIGHT_H__
+#define __AMBIENT_LIGHT_H__
+
+#include <stdint.h>
+
+/**
+ * @brief configuration of the brightness controller following the ambient light
+ */
+typedef struct
+{
+  /**
+   * @brief time between two samples of the light sensor in ms
+   */
+  uint32_t sampleIntervalMs;
+
+  /**
+   * @brief the reading of the ADC in a dark room, shown with minLevel
+   */
+  uint16_t darkReading;
+
+  /**
+   * @brief the reading of the ADC in a bright room, shown with maxLevel
+   */
+  uint16_t brightReading;
+
+  /**
+   * @brief the perceptual brightness level at darkReading and below
+   */
+  uint16_t minLevel;
+
+  /**
+   * @brief the perceptual brightness level at brightReading and above
+   */
+  uint16_t maxLevel;
+
+  /**
+   * @brief the level only follows the light if it changed by more than this,
+   * so noise around a threshold does not make the display flicker
+   */
+  uint16_t hysteresis;
+
+  /**
+   * @brief the weight of a new sample in the moving average is 1 / 2^filterShift
+   */
+  uint8_t filterShift;
+} AmbientLightConfig;
+
+/**
+ * @brief state of the brightness controller
+ */
+typedef struct
+{
+  /**
+   * @brief the exponential moving average of the readings in 1/16
+   */
+  uint32_t filtered;
+
+  /**
+   * @brief the brightness level currently shown
+   */
+  uint16_t level;
+
+  /**
+   * @brief millis() after which the next sample is due
+   */
+  uint32_t nextSampleAt;
+
+  /**
+   * @brief false until the first sample was taken
+   */
+  bool started;
+} AmbientLight;
+
+/**
+ * @brief check if the next sample of the light sensor is due
+ *
+ * @param nowMs the current millis()
+ */
+bool ambientLightDue(const AmbientLight &light, uint32_t nowMs);
+
+/**
+ * @brief add a sample of the light sensor and compute the brightness level
+ *
+ * @param reading the reading of the ADC
+ * @param nowMs the current millis()
+ * @return true if the level changed and has to be applied to the display
+ */
+bool ambientLightUpdate(AmbientLight *light, const AmbientLightConfig &config, uint16_t reading, uint32_t nowMs);
+
+#endif //__AMBIENT_LIGHT_H__
\ No newline at end of file
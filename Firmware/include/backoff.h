@@ -0,0 +1,84 @@
+#ifndef __BACKOFF_H__
+#define __BACKOFF_H__
+
+#include <stdint.h>
+
+/**
+ * @brief configuration of a resync scheduler
+ */
+typedef struct
+{
+  /**
+   * @brief delay before the first retry in ms, doubled with every failure
+   */
+  uint32_t baseDelayMs;
+
+  /**
+   * @brief upper limit of the delay between two retries in ms
+   */
+  uint32_t maxDelayMs;
+
+  /**
+   * @brief number of consecutive failures from which on the WiFi is reconnected
+   * before every retry
+   */
+  uint8_t reconnectAfter;
+
+  /**
+   * @brief number of consecutive failures after which the ESP is rebooted
+   */
+  uint8_t rebootAfter;
+} BackoffConfig;
+
+/**
+ * @brief state of a resync scheduler
+ */
+typedef struct
+{
+  /**
+   * @brief number of consecutive failures
+   */
+  uint8_t failures;
+
+  /**
+   * @brief millis() after which the next attempt is due
+   */
+  uint32_t nextAttemptAt;
+} Backoff;
+
+// what to do after a failed attempt
+enum class BackoffAction
+{
+  // wait for the next attempt to be due
+  Retry,
+  // reconnect the WiFi before the next attempt
+  ReconnectWifi,
+  // reboot the ESP
+  Reboot,
+};
+
+/**
+ * @brief check if the next attempt is due
+ *
+ * @param nowMs the current millis()
+ */
+bool backoffDue(const Backoff &backoff, uint32_t nowMs);
+
+/**
+ * @brief reset the scheduler after a successful attempt
+ */
+void backoffSucceeded(Backoff *backoff);
+
+/**
+ * @brief schedule the next attempt after a failed one
+ *
+ * The delay doubles with every consecutive failure up to the maximum,
+ * with a jitter of up to -25% so many clocks don't retry in lockstep
+ *
+ * @param nowMs the current millis()
+ * @param randomValue any random number to derive the jitter from
+ * @return the action to take for this failure
+ */
+BackoffAction backoffFailed(Backoff *backoff, const BackoffConfig &config, uint32_t nowMs, uint32_t randomValue);
+
+#endif //__BACKOFF_H__
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef __CLOCK_CONFIG_H__
+#define __CLOCK_CONFIG_H__
+
+#include <stdint.h>
+
+/**
+ * @brief the settings of the clock that can be changed over the web API
+ */
+typedef struct
+{
+  /**
+   * @brief the name of the timezone as known by the timezonedb
+   * (only used with USE_TIMEZONEDB)
+   */
+  char timezoneName[48];
+
+  /**
+   * @brief the rules of the timezone as POSIX TZ string
+   */
+  char timezoneRule[64];
+
+  /**
+   * @brief the hour the display is dimmed at
+   */
+  uint8_t beginLowBrightnessHour;
+
+  /**
+   * @brief the hour the display is back to full brightness
+   */
+  uint8_t endLowBrightnessHour;
+
+  /**
+   * @brief the perceptual brightness level during the day
+   */
+  uint16_t dayLevel;
+
+  /**
+   * @brief the perceptual brightness level during the low-brightness period
+   */
+  uint16_t nightLevel;
+
+  /**
+   * @brief true to exercise all cathodes every hour of the low-brightness period
+   */
+  bool antiPoisoning;
+} ClockConfig;
+
+#endif //__CLOCK_CONFIG_H__
\ No newline at end of file
@@ -0,0 +1,101 @@
+#ifndef __DISPLAY_H__
+#define __DISPLAY_H__
+
+#include <Arduino.h>
+#include <TimeLib.h>
+
+#include "display_hal.h"
+
+// the engines available to refresh the display from the timer1 ISR
+enum class DisplayEngine
+{
+  // software PWM: one frame per brightness step, every frame is masked
+  // by comparing a counter against the brightness
+  Pwm,
+  // Binary Code Modulation: one precomputed frame per bit of the brightness,
+  // each shown for a time weighted by the bit (1, 2, 4, 8, ...)
+  Bcm,
+};
+
+#ifndef DISPLAY_ENGINE
+// the shortest bit-plane of the BCM has to be longer than shifting out
+// a frame, it is derived from the frame time of the bus (displayBusFrameUs)
+#define DISPLAY_ENGINE DisplayEngine::Bcm
+#endif
+const DisplayEngine displayEngine = DISPLAY_ENGINE;
+
+// number of bit-planes (and thus the brightness resolution) of the BCM
+const uint8_t bcmBits = 8;
+
+// PWM: The display is refreshed one brightness step per tick. Bit-banging a
+// frame takes ~10µs, with 50 brightness levels the PWM period is ~2ms (500Hz).
+// When the shift registers are driven by the HSPI a frame only takes a few µs,
+// which allows much finer brightness steps and a 400Hz refresh rate at the same time.
+// BCM: 8 frames per period give 256 brightness levels at ~500Hz with the HSPI
+// and ~350Hz bit-banged
+const uint8_t maxBrightness = displayEngine == DisplayEngine::Bcm ? (1 << bcmBits) - 1 : (displayBusUsesHardwareSpi ? 250 : 50);
+
+// the time the digits of a tube are crossfaded when they change
+const uint16_t crossfadeMs = 200;
+
+// number of bits of the perceptual brightness level of setDisplayLevel()
+const uint8_t displayLevelBits = 12;
+
+// the perceptual brightness level of a fully lit display
+const uint16_t maxDisplayLevel = (1 << displayLevelBits) - 1;
+
+/**
+ * @brief setup the display bus and start the timer-driven refresh
+ */
+void displayBegin();
+
+/**
+ * @brief Display the passed time on the nixie display
+ * Encodes the bit pattern to display the passed time digits
+ * on the nixie display, it is shown with the next refresh.
+ * Changed digits are crossfaded over crossfadeMs
+ *
+ * @param time time to display
+ * @param dots bitmask of the dots to light, bit 0 is the leftmost digit
+ */
+void setDisplay(tmElements_t time, uint8_t dots = 0x00);
+
+/**
+ * @brief split a time into the digits of the tubes
+ *
+ * @param[out] digits numDigits values from the leftmost tube, HH:MM or HH:MM:SS
+ */
+void timeToDigits(const tmElements_t &time, uint8_t *digits);
+
+/**
+ * @brief Display arbitrary digits on the nixie display
+ *
+ * @param digits the number to show on every tube from the leftmost one,
+ * numDigits values. Tubes with a value above 9 stay dark
+ * @param dots bitmask of the dots to light, bit 0 is the leftmost digit
+ * @param colon true to light the colon LEDs
+ * @param crossfade false to switch the digits right away, e.g. for
+ * animations with frames shorter than crossfadeMs
+ */
+void setDisplayDigits(const uint8_t *digits, uint8_t dots, bool colon, bool crossfade = true);
+
+/**
+ * @brief set the PWM duty cycle of the digits and the colon LEDs
+ *
+ * @param digits brightness of the digits from 0 (off) to maxBrightness
+ * @param leds brightness of the colon from 0 (off) to maxBrightness
+ */
+void setDisplayBrightness(uint8_t digits, uint8_t leds);
+
+/**
+ * @brief set the perceived brightness of the digits and the colon LEDs
+ *
+ * The levels are gamma corrected, so every step looks equally large.
+ * Steps finer than the duty cycle of a period are dithered over the periods
+ *
+ * @param digits brightness of the digits from 0 (off) to maxDisplayLevel
+ * @param leds brightness of the colon from 0 (off) to maxDisplayLevel
+ */
+void setDisplayLevel(uint16_t digits, uint16_t leds);
+
+#endif //__DISPLAY_H__
\ No newline at end of file
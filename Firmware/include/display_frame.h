@@ -0,0 +1,141 @@
+#ifndef __DISPLAY_FRAME_H__
+#define __DISPLAY_FRAME_H__
+
+#include <stdint.h>
+
+#include "pins.h"
+
+// A frame holds one byte per chip in the order the bytes are shifted out:
+// the first byte ends up in the last chip of the chain. Encoding a frame
+// and masking it is done with byte operations only, so it scales with the
+// number of chips and needs no wide integers (64-bit shifts are slow on
+// the Xtensa LX106 and cap the chain at 8 chips).
+
+/**
+ * @brief a single output of the shift register chain within a frame
+ */
+struct FrameBit
+{
+  /**
+   * @brief index of the byte in the frame
+   */
+  uint8_t byte;
+
+  /**
+   * @brief mask of the output within the byte
+   */
+  uint8_t mask;
+};
+
+/**
+ * @brief a set of outputs of the shift register chain as bytes of a frame
+ */
+struct FrameMask
+{
+  uint8_t bytes[numChips];
+};
+
+/**
+ * @brief the outputs of all cathodes, dots and LEDs within a frame
+ */
+struct FrameTable
+{
+  FrameBit digits[numDigits][10];
+  FrameBit dots[numDigits];
+  FrameBit leds[2];
+};
+
+/**
+ * @brief convert a bitnumber in the serial output stream (see P2B())
+ * to the byte and bitmask within a frame
+ */
+constexpr FrameBit toFrameBit(uint8_t streamBit)
+{
+  return {(uint8_t)(numChips - 1 - streamBit / 8), (uint8_t)(1 << (streamBit % 8))};
+}
+
+/**
+ * @brief add an output to a mask
+ */
+constexpr void addToFrameMask(FrameMask &mask, uint8_t streamBit)
+{
+  FrameBit bit = toFrameBit(streamBit);
+  mask.bytes[bit.byte] |= bit.mask;
+}
+
+/**
+ * @brief map the pinmaps of a variant to the outputs in a frame
+ *
+ * @tparam V the traits of the variant, see pins_IN12.h
+ */
+template <typename V>
+constexpr FrameTable makeFrameTable()
+{
+  static_assert(V::numChips == numChips && V::numDigits == numDigits, "the frames are sized for the selected variant");
+
+  FrameTable table{};
+  for (uint8_t digit = 0; digit < numDigits; digit++)
+  {
+    for (uint8_t value = 0; value < 10; value++)
+    {
+      table.digits[digit][value] = toFrameBit(V::digitsPinmap[digit][value]);
+    }
+    table.dots[digit] = toFrameBit(V::dotsPinmap[digit]);
+  }
+  for (uint8_t led = 0; led < 2; led++)
+  {
+    table.leds[led] = toFrameBit(V::ledsPinmap[led]);
+  }
+  return table;
+}
+
+// the mapping of the pinmaps of the selected variant to outputs in a frame,
+// generated at compile time
+constexpr FrameTable frameTable = makeFrameTable<Variant>();
+
+/**
+ * @brief the outputs of all cathodes of a variant
+ */
+template <typename V>
+constexpr FrameMask makeDigitsFrameMask()
+{
+  FrameMask mask{};
+  for (uint8_t digit = 0; digit < V::numDigits; digit++)
+  {
+    for (uint8_t value = 0; value < 10; value++)
+    {
+      addToFrameMask(mask, V::digitsPinmap[digit][value]);
+    }
+  }
+  return mask;
+}
+
+/**
+ * @brief the outputs of the colon LEDs of a variant
+ */
+template <typename V>
+constexpr FrameMask makeLedsFrameMask()
+{
+  FrameMask mask{};
+  for (uint8_t led = 0; led < 2; led++)
+  {
+    addToFrameMask(mask, V::ledsPinmap[led]);
+  }
+  return mask;
+}
+
+// bitmask in a frame for all digits
+constexpr FrameMask digitsFrameMask = makeDigitsFrameMask<Variant>();
+
+// bitmask in a frame for the LEDs
+constexpr FrameMask ledsFrameMask = makeLedsFrameMask<Variant>();
+
+/**
+ * @brief light the passed output in the frame
+ */
+inline void setFrameBit(uint8_t *frame, const FrameBit &bit)
+{
+  frame[bit.byte] |= bit.mask;
+}
+
+#endif //__DISPLAY_FRAME_H__
\ No newline at end of file
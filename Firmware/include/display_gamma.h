@@ -0,0 +1,81 @@
+#ifndef __DISPLAY_GAMMA_H__
+#define __DISPLAY_GAMMA_H__
+
+#include <stdint.h>
+
+#include "display.h"
+
+// The perceived brightness of the tubes is not linear to the duty cycle.
+// A perceptual level is converted to a duty cycle with finer steps than the
+// engine can show in a period, the fraction of a step is dithered over
+// ditherPhases periods.
+
+// number of bits of a duty cycle below a brightness step of the engine
+const uint8_t ditherBits = 4;
+
+// number of periods the fraction of a brightness step is dithered over.
+// At the lowest levels this pulses with ~22Hz (bit-banged BCM), which is
+// still much less visible than the steps of the plain duty cycle
+const uint8_t ditherPhases = 1 << ditherBits;
+
+// the duty cycle at maxDisplayLevel in 1/ditherPhases brightness steps
+const uint16_t maxDuty = maxBrightness << ditherBits;
+
+// number of entries of the LUT, the levels in between are interpolated
+constexpr uint8_t gammaLutBits = 6;
+constexpr uint8_t gammaLutSize = (1 << gammaLutBits) + 1;
+
+// the levels between two entries of the LUT
+constexpr uint8_t gammaLutShift = displayLevelBits - gammaLutBits;
+
+/**
+ * @brief the duty cycles of evenly spaced perceptual levels
+ */
+struct GammaLut
+{
+  uint16_t duty[gammaLutSize];
+};
+
+/**
+ * @brief the relative luminance of a lightness 0..100 (CIE 1931)
+ */
+constexpr double lightnessToLuminance(double lightness)
+{
+  return lightness <= 8 ? lightness / 903.3 : ((lightness + 16) / 116) * ((lightness + 16) / 116) * ((lightness + 16) / 116);
+}
+
+constexpr GammaLut makeGammaLut()
+{
+  GammaLut lut{};
+  for (uint8_t entry = 0; entry < gammaLutSize; entry++)
+  {
+    double lightness = 100.0 * entry / (gammaLutSize - 1);
+    lut.duty[entry] = (uint16_t)(lightnessToLuminance(lightness) * maxDuty + 0.5);
+  }
+  return lut;
+}
+
+// evaluated at compile time
+constexpr GammaLut gammaLut = makeGammaLut();
+
+/**
+ * @brief convert a perceptual level to a duty cycle
+ *
+ * @param level the level 0..maxDisplayLevel
+ * @return the duty cycle in 1/ditherPhases brightness steps 0..maxDuty
+ */
+inline uint16_t levelToDuty(uint16_t level)
+{
+  if (level >= maxDisplayLevel)
+  {
+    return maxDuty;
+  }
+
+  uint8_t entry = level >> gammaLutShift;
+  uint16_t fraction = level & ((1 << gammaLutShift) - 1);
+  uint16_t low = gammaLut.duty[entry];
+  uint16_t high = gammaLut.duty[entry + 1];
+  return low + (uint16_t)(((uint32_t)(high - low) * fraction + (1 << (gammaLutShift - 1))) >> gammaLutShift);
+}
+
+#endif //__DISPLAY_GAMMA_H__
\ No newline at end of file
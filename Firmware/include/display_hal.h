@@ -0,0 +1,80 @@
+#ifndef __DISPLAY_HAL_H__
+#define __DISPLAY_HAL_H__
+
+#include <Arduino.h>
+
+#include "pins.h"
+
+// pins of the HSPI peripheral of the ESP8266. The pins of the HSPI are fixed,
+// so the hardware can only drive the shift registers if they are wired to these.
+
+// clock pin of the HSPI (D5)
+const uint8_t hspiClockPin = 14;
+// data (MOSI) pin of the HSPI (D7)
+const uint8_t hspiDataPin = 13;
+
+// use the HSPI peripheral if the wiring in pins.h allows it,
+// fall back to bit-banging the data otherwise
+const bool displayBusUsesHardwareSpi = clockPin == hspiClockPin && dataPin == hspiDataPin;
+
+// clock frequency of the HSPI, well within the timing limits of the TPIC6B595.
+// shifting out 6 chips takes ~6µs instead of ~177µs when bit-banging
+const uint32_t displaySpiFrequency = 8000000;
+
+// worst case time the refresh ISR needs to latch and shift out a frame in µs
+// (including the ISR overhead). The HSPI transfer runs in the background but
+// has to finish before the next latch, bit-banging with direct register access
+// takes ~2µs per chip
+const uint32_t displayBusFrameUs =
+    displayBusUsesHardwareSpi ? (numChips * 8 * 1000000 + displaySpiFrequency - 1) / displaySpiFrequency + 1
+                              : 2 * numChips;
+
+// timer1 runs from the 80MHz APB clock divided by 16
+const uint32_t displayTimerTicksPerUs = 5;
+
+/**
+ * @brief setup the GPIOs (and the HSPI if used) connected to the shift registers
+ */
+void displayBusBegin();
+
+/**
+ * @brief latch the data shifted out by the last displayBusShift() into the outputs
+ *
+ * Waits for a running HSPI transfer to finish first.
+ * Safe to be called from the refresh ISR (placed in IRAM)
+ */
+void displayBusLatch();
+
+/**
+ * @brief shift out a complete frame to the shift registers without latching it
+ *
+ * When the HSPI is used this only starts the transfer and returns immediately,
+ * the data is shifted out in the background until the next displayBusLatch().
+ * Safe to be called from the refresh ISR (placed in IRAM)
+ *
+ * @param frame numChips bytes in the order they are shifted out, the first byte
+ * ends up in the last chip of the chain
+ */
+void displayBusShift(const uint8_t *frame);
+
+/**
+ * @brief call the passed ISR from the hardware timer1
+ *
+ * The timer is started by the first displayTimerArm()
+ *
+ * @param isr the function to call, must be placed in IRAM
+ * @param periodic true to reload the timer with the armed ticks after every
+ * call, false to fire only once per displayTimerArm()
+ */
+void displayTimerBegin(void (*isr)(), bool periodic);
+
+/**
+ * @brief (re-)start the timer to call the ISR after the passed number of ticks
+ *
+ * Safe to be called from the refresh ISR (placed in IRAM)
+ *
+ * @param ticks the delay in timer ticks (displayTimerTicksPerUs per µs)
+ */
+void displayTimerArm(uint32_t ticks);
+
+#endif //__DISPLAY_HAL_H__
\ No newline at end of file
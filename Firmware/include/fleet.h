@@ -0,0 +1,76 @@
+#ifndef __FLEET_H__
+#define __FLEET_H__
+
+#include <Arduino.h>
+
+#include "tzinfo.h"
+
+// Many clocks on one LAN share the time: one clock, the leader, syncs with
+// NTP (and queries the timezone info) and multicasts the time and the
+// timezone info. The other clocks, the followers, set their time from it
+// instead. The leader announces itself over mDNS, so a clock that boots
+// into a fleet with a leader does not sync on its own at all. If the leader
+// goes silent the followers take over, the clock with the lowest chip ID wins.
+
+// the role of the clock in the fleet
+enum class FleetRole
+{
+  // syncs on its own and takes over the lead once synced,
+  // unless a leader is heard in the meantime
+  Candidate,
+  // syncs on its own and multicasts the time
+  Leader,
+  // sets the time from the leader, does not sync on its own
+  Follower,
+};
+
+/**
+ * @brief the time and timezone info received from the leader
+ */
+typedef struct
+{
+  /**
+   * @brief the time of the leader as unix timestamp (UTC)
+   */
+  time_t utc;
+
+  /**
+   * @brief the timezone info of the leader
+   */
+  TzInfo tzInfo;
+} FleetTime;
+
+/**
+ * @brief join the multicast group and look for a leader over mDNS
+ *
+ * Call once the WiFi is connected and the mDNS responder is started.
+ * The lookup blocks for up to a second
+ */
+void fleetBegin();
+
+/**
+ * @brief handle the received packets and the failover, call from loop()
+ *
+ * @param synced true if the clock synced on its own and could lead
+ * @param[out] out the time of the leader, only written if the clock follows
+ * and a packet of the leader was received
+ * @return true if the out param was written
+ */
+bool fleetService(bool synced, FleetTime *out);
+
+/**
+ * @brief multicast the time if the clock leads, call once per second
+ *
+ * The time is multicast right after the second changed, so the
+ * followers change their seconds at the same time
+ *
+ * @param utc the current time as unix timestamp (UTC)
+ */
+void fleetAnnounce(time_t utc, const TzInfo &tzInfo);
+
+/**
+ * @brief the current role of the clock
+ */
+FleetRole fleetRole();
+
+#endif //__FLEET_H__
\ No newline at end of file
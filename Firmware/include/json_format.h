@@ -0,0 +1,18 @@
+#ifndef __JSON_FORMAT_H__
+#define __JSON_FORMAT_H__
+
+#include <Arduino.h>
+
+/**
+ * @brief append formatted text to a buffer
+ *
+ * Used to assemble the JSON of the stats piece by piece. Once the buffer is
+ * full the rest is dropped, but the length keeps counting
+ *
+ * @param length the length of the text already in the buffer
+ * @return the new length of the text (may be larger than the buffer if it was truncated)
+ */
+size_t appendFormat(char *buffer, size_t size, size_t length, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#endif //__JSON_FORMAT_H__
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef __PERSISTENCE_H__
+#define __PERSISTENCE_H__
+
+#include <Arduino.h>
+
+#include "clock_config.h"
+#include "tzinfo.h"
+
+// the first 128 bytes (32 blocks) of the RTC user memory are overwritten by
+// OTA updates. The time takes the next 4 blocks, the trace the ones after it
+const uint8_t rtcTimeBlock = 32;
+const uint8_t rtcTimeBlocks = 4;
+
+/**
+ * @brief allocate the buffer of the emulated EEPROM, call before any
+ * other function accessing the flash
+ */
+void persistenceBegin();
+
+/**
+ * @brief load the timezone info saved in flash
+ *
+ * @param[out] out the saved timezone info
+ * @return true if a valid timezone info was saved and the out param is written
+ * @return false otherwise
+ */
+bool loadTzInfo(TzInfo *out);
+
+/**
+ * @brief save the timezone info to flash
+ *
+ * The flash is only written if the info changed
+ */
+void saveTzInfo(const TzInfo &tzInfo);
+
+/**
+ * @brief load the config saved in flash
+ *
+ * @param[out] out the saved config
+ * @return true if a valid config was saved and the out param is written
+ * @return false otherwise
+ */
+bool loadConfig(ClockConfig *out);
+
+/**
+ * @brief save the config to flash
+ *
+ * The flash is only written if the config changed
+ */
+void saveConfig(const ClockConfig &config);
+
+/**
+ * @brief estimate the current time from the time saved in the RTC memory
+ *
+ * The RTC memory survives soft resets (ESP.restart(), WDT, exceptions)
+ * but not a power loss. The time is only restored after a soft reset, after
+ * any other reset the saved time is discarded
+ *
+ * @param[out] out the estimated current time as unix timestamp (UTC)
+ * @return true if a valid time was saved before the reset and the out param is written
+ * @return false otherwise
+ */
+bool loadRtcTime(time_t *out);
+
+/**
+ * @brief save the current time to the RTC memory
+ *
+ * Cheap enough to be called every second
+ *
+ * @param utc the current time as unix timestamp (UTC)
+ */
+void saveRtcTime(time_t utc);
+
+#endif //__PERSISTENCE_H__
\ No newline at end of file
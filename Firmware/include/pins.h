@@ -12,20 +12,37 @@ const uint8_t clockPin = 4;
 // data pin of TPIC6B595 connected to D3
 const uint8_t dataPin = 0;
 
-// number of HV shift registers on the serial data bus
-const uint8_t numChips = 6;
-
-// number of digit tubes in the clock
-const uint8_t numDigits = 4;
+// the wiring of the boards, a traits type for every tube variant
+#include "pins_IN12.h"
+#include "pins_IN14.h"
 
+// the variant is selected by the build env, the display is only
+// built for the tables of that variant
 #ifdef VARIANT
     #if VARIANT == 12
-        #include "pins_in12.h"
+        using Variant = In12Variant;
     #elif VARIANT == 14
-        #include "pins_IN14.h"
+        using Variant = In14Variant;
+    #else
+        #error Unknown tube VARIANT (12 or 14)
     #endif
 #else
     #error You need to define the tube VARIANT (12 or 14)
 #endif
 
+// number of HV shift registers on the serial data bus
+constexpr uint8_t numChips = Variant::numChips;
+
+// number of digit tubes in the clock, HH:MM or HH:MM:SS
+constexpr uint8_t numDigits = Variant::numDigits;
+
+// the bits of the serial stream are numbered with a byte (see P2B())
+static_assert(numChips * 8 <= UINT8_MAX, "at most 31 chips on the serial data bus");
+static_assert(numDigits == 4 || numDigits == 6, "the display shows HH:MM or HH:MM:SS");
+
+// the pinmaps of the selected variant
+static constexpr auto &digitsPinmap = Variant::digitsPinmap;
+static constexpr auto &ledsPinmap = Variant::ledsPinmap;
+static constexpr auto &dotsPinmap = Variant::dotsPinmap;
+
 #endif //__PINS_H__
\ No newline at end of file
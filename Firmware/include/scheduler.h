@@ -0,0 +1,117 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <Arduino.h>
+
+// The loop() is a cooperative scheduler: every pass runs the due tasks in
+// the order of the table, the first task has the highest priority. Once a
+// pass used up its budget the remaining tasks wait for the next pass, which
+// starts with them before it wraps around to the top of the table, so the
+// tasks running on every pass can't starve the ones after them. Nothing
+// preempts a task, the time of every run is measured and overruns and
+// missed deadlines are counted instead. The display refresh itself runs
+// from the timer1 ISR and is never delayed by any of the tasks.
+
+// the maximum number of tasks in the table
+const uint8_t maxTasks = 16;
+
+/**
+ * @brief a task of the table passed to schedulerBegin()
+ */
+typedef struct
+{
+  /**
+   * @brief the name in the stats
+   */
+  const char *name;
+
+  /**
+   * @brief the function doing the work, must return within its budget
+   */
+  void (*run)();
+
+  /**
+   * @brief the time between two runs in ms, 0 to run on every pass
+   */
+  uint32_t periodMs;
+
+  /**
+   * @brief the latest a run may start after it was due in ms,
+   * later runs count as missed deadline
+   */
+  uint32_t deadlineMs;
+
+  /**
+   * @brief the time a run may take in µs, longer runs count as overrun
+   */
+  uint32_t budgetUs;
+} Task;
+
+/**
+ * @brief the measured runs of a task
+ */
+typedef struct
+{
+  /**
+   * @brief millis() when the next run is due
+   */
+  uint32_t dueAt;
+
+  /**
+   * @brief number of runs since boot
+   */
+  uint32_t runs;
+
+  /**
+   * @brief longest run in µs
+   */
+  uint32_t maxRunUs;
+
+  /**
+   * @brief number of runs that took longer than the budget
+   */
+  uint32_t overruns;
+
+  /**
+   * @brief number of runs that started later than the deadline
+   */
+  uint32_t missedDeadlines;
+
+  /**
+   * @brief latest start of a run after it was due in ms
+   */
+  uint32_t maxLatenessMs;
+} TaskStats;
+
+/**
+ * @brief set the table of tasks, all of them are due right away
+ *
+ * @param tasks the table sorted by priority, must stay valid
+ * @param count the number of tasks, at most maxTasks
+ */
+void schedulerBegin(const Task *tasks, uint8_t count);
+
+/**
+ * @brief run a pass over the due tasks, call from loop()
+ *
+ * @param budgetUs the time after which no further task is started in this
+ * pass. The first due task is always run, the next pass starts with the
+ * task this one stopped at
+ */
+void schedulerRun(uint32_t budgetUs);
+
+/**
+ * @brief reset the maxima and counters of the overruns and missed deadlines
+ */
+void schedulerReset();
+
+/**
+ * @brief format the stats of the tasks as JSON array
+ *
+ * @param[out] buffer the buffer to write the null-terminated JSON to
+ * @param size the size of the buffer
+ * @return the length of the JSON (may be larger than the buffer if it was truncated)
+ */
+size_t formatTasks(char *buffer, size_t size);
+
+#endif //__SCHEDULER_H__
\ No newline at end of file
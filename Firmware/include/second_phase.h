@@ -0,0 +1,106 @@
+#ifndef __SECOND_PHASE_H__
+#define __SECOND_PHASE_H__
+
+#include <Arduino.h>
+
+// TimeLib and the NTPClient only know whole seconds: the time is set when
+// the NTP response arrives, so the second flips up to a second late. The
+// phase probe sends its own SNTP request and keeps the fraction of the
+// second and the network delay, which gives the millis() at which a UTC
+// second started. Only the moment the displayed second flips is taken from
+// it, TimeLib keeps the time and the sync schedule of the NTPClient.
+
+/**
+ * @brief the measured start of a UTC second
+ */
+typedef struct
+{
+  /**
+   * @brief false until a second was measured
+   */
+  bool valid;
+
+  /**
+   * @brief the second as unix timestamp (UTC)
+   */
+  time_t utc;
+
+  /**
+   * @brief millis() when the second started
+   */
+  uint32_t atMillis;
+
+  /**
+   * @brief the network delay of the measurement in ms,
+   * the start of the second is accurate to half of it
+   */
+  uint16_t delayMs;
+} SecondPhase;
+
+/**
+ * @brief send an SNTP request to measure the start of the second
+ *
+ * Resolving the server blocks, usually the address is in the DNS cache
+ *
+ * @param server the host name of the NTP server
+ * @return false if the request could not be sent
+ */
+bool phaseProbeStart(const char *server);
+
+/**
+ * @brief check for the response of the running request, call from loop()
+ *
+ * @param[out] out the measured start of the second, only written if a valid
+ * response was received
+ * @return true if the out param was written
+ */
+bool phaseProbeService(SecondPhase *out);
+
+/**
+ * @return true if a request was sent and neither answered nor timed out
+ */
+bool phaseProbeRunning();
+
+/**
+ * @brief the current UTC second derived from the measured phase
+ *
+ * @param nowMs the current millis()
+ */
+inline time_t phaseUtc(const SecondPhase &phase, uint32_t nowMs)
+{
+  return phase.utc + (nowMs - phase.atMillis) / 1000;
+}
+
+/**
+ * @brief the time since the start of the current UTC second in ms
+ *
+ * @param nowMs the current millis()
+ */
+inline uint32_t phaseMsIntoSecond(const SecondPhase &phase, uint32_t nowMs)
+{
+  return (nowMs - phase.atMillis) % 1000;
+}
+
+/**
+ * @brief the local time to display, flipping at the measured start of the second
+ *
+ * The clock itself is never set, so the syncs of the NTPClient keep running.
+ * A phase that disagrees with the clock by more than a second is stale (or
+ * the clock was corrected since), the clock is shown as it is then
+ *
+ * @param nowMs the current millis()
+ * @param localTime the current local time of the clock (now())
+ * @param offset the offset of the local time to UTC in seconds
+ */
+inline time_t phaseLocalTime(const SecondPhase &phase, uint32_t nowMs, time_t localTime, int32_t offset)
+{
+  if (!phase.valid)
+  {
+    return localTime;
+  }
+
+  time_t phaseTime = phaseUtc(phase, nowMs) + offset;
+  return phaseTime - localTime > 1 || localTime - phaseTime > 1 ? localTime : phaseTime;
+}
+
+#endif //__SECOND_PHASE_H__
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef __SLOT_MACHINE_H__
+#define __SLOT_MACHINE_H__
+
+#include <Arduino.h>
+#include <TimeLib.h>
+
+// The cathodes of a nixie tube that are not lit for a long time get poisoned
+// by the material sputtered from the lit ones. The slot machine animation
+// spins all tubes through all cathodes, every cathode of every tube is lit
+// for the same time. The tubes stop one after the other on the current time.
+
+/**
+ * @brief start the animation, it is advanced by slotMachineService()
+ *
+ * @param durationMs the time all tubes spin before the first one stops
+ */
+void slotMachineStart(uint32_t durationMs);
+
+/**
+ * @brief show the next frame of the animation when it is due, call from loop()
+ *
+ * Never blocks, frames missed while loop() was busy are skipped
+ *
+ * @param localTime the time the tubes stop on
+ */
+void slotMachineService(time_t localTime);
+
+/**
+ * @brief true while the animation owns the display
+ */
+bool slotMachineRunning();
+
+#endif //__SLOT_MACHINE_H__
\ No newline at end of file
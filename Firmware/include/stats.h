@@ -0,0 +1,185 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <Arduino.h>
+
+// number of buckets of the histograms
+const uint8_t statsBuckets = 8;
+
+// the frame time histogram counts refresh ISR runs in buckets of CPU cycles:
+// bucket 0 < 512 cycles <= bucket 1 < 1024 cycles ... <= bucket 7
+const uint8_t frameHistogramFirstBit = 9;
+
+// the heap history keeps the smallest largest free block of each of the
+// last statsBuckets hours
+const uint32_t heapHistoryPeriodS = 60 * 60;
+
+// the loop histogram counts loop() iterations in buckets of µs:
+// bucket 0 < 64µs <= bucket 1 < 128µs ... <= bucket 7 (8.2ms and more)
+const uint8_t loopHistogramFirstBit = 6;
+
+typedef struct
+{
+  /**
+   * @brief number of frames latched since boot
+   */
+  uint32_t frames;
+
+  /**
+   * @brief number of frames that differed from the last one and were shifted out,
+   * the others were only latched again
+   */
+  uint32_t shifts;
+
+  /**
+   * @brief CPU cycles the last run of the refresh ISR took
+   */
+  uint32_t lastFrameCycles;
+
+  /**
+   * @brief most CPU cycles a run of the refresh ISR took
+   */
+  uint32_t maxFrameCycles;
+
+  /**
+   * @brief histogram of the CPU cycles of the refresh ISR runs
+   */
+  uint32_t frameHistogram[statsBuckets];
+
+  /**
+   * @brief number of loop() iterations since boot
+   */
+  uint32_t loops;
+
+  /**
+   * @brief longest time between the start of two loop() iterations in µs
+   */
+  uint32_t maxLoopStallUs;
+
+  /**
+   * @brief histogram of the time between two loop() iterations
+   */
+  uint32_t loopHistogram[statsBuckets];
+
+  /**
+   * @brief longest time a loop() iteration spent in the HTTP server in µs
+   */
+  uint32_t maxHttpUs;
+
+  /**
+   * @brief free heap in bytes, sampled once per second by statsLoop()
+   */
+  uint32_t freeHeap;
+
+  /**
+   * @brief least free heap since boot (or the last reset of the stats)
+   */
+  uint32_t minFreeHeap;
+
+  /**
+   * @brief largest block that can be allocated in bytes, sampled with the free heap
+   */
+  uint32_t maxFreeBlock;
+
+  /**
+   * @brief smallest largest free block since boot (or the last reset of the stats)
+   */
+  uint32_t minMaxFreeBlock;
+
+  /**
+   * @brief fragmentation of the free heap in % (0: a single free block)
+   */
+  uint8_t heapFragmentation;
+
+  /**
+   * @brief highest fragmentation since boot (or the last reset of the stats)
+   */
+  uint8_t maxHeapFragmentation;
+
+  /**
+   * @brief smallest largest free block of each of the last hours, newest first.
+   * A leak or growing fragmentation shows up as a falling series
+   */
+  uint32_t heapHistory[statsBuckets];
+} Stats;
+
+// written by the refresh ISR and loop(), read by the stats output
+extern volatile Stats stats;
+
+/**
+ * @brief the bucket of a value in a histogram with power of two buckets
+ */
+inline __attribute__((always_inline)) uint8_t statsBucket(uint32_t value, uint8_t firstBit)
+{
+  // index of the highest bit set, compiles to a single NSAU instruction
+  int8_t bit = 31 - __builtin_clz(value | 1);
+  int8_t bucket = bit - firstBit + 1;
+  return bucket < 0 ? 0 : (bucket >= statsBuckets ? statsBuckets - 1 : bucket);
+}
+
+/**
+ * @brief CPU cycle counter at the start of a refresh ISR run
+ *
+ * Inlined so the refresh ISR stays in IRAM
+ */
+inline __attribute__((always_inline)) uint32_t statsFrameStart()
+{
+  return ESP.getCycleCount();
+}
+
+/**
+ * @brief record a frame shifted out by the refresh ISR
+ *
+ * Inlined so the refresh ISR stays in IRAM
+ */
+inline __attribute__((always_inline)) void statsShift()
+{
+  stats.shifts++;
+}
+
+/**
+ * @brief record a run of the refresh ISR
+ *
+ * Inlined so the refresh ISR stays in IRAM
+ *
+ * @param startCycles the value returned by statsFrameStart()
+ */
+inline __attribute__((always_inline)) void statsFrameEnd(uint32_t startCycles)
+{
+  uint32_t cycles = ESP.getCycleCount() - startCycles;
+  stats.frames++;
+  stats.lastFrameCycles = cycles;
+  if (cycles > stats.maxFrameCycles)
+  {
+    stats.maxFrameCycles = cycles;
+  }
+  stats.frameHistogram[statsBucket(cycles, frameHistogramFirstBit)]++;
+}
+
+/**
+ * @brief record an iteration of the loop(), call at the start of the loop()
+ *
+ * @return the time since the start of the last iteration in µs
+ */
+uint32_t statsLoop();
+
+/**
+ * @brief record the time a loop() iteration spent in the HTTP server
+ */
+void statsHttp(uint32_t us);
+
+/**
+ * @brief reset the maxima and histograms
+ */
+void statsReset();
+
+/**
+ * @brief format the stats as JSON object
+ *
+ * @param[out] buffer the buffer to write the null-terminated JSON to
+ * @param size the size of the buffer
+ * @return the length of the JSON (may be larger than the buffer if it was truncated)
+ */
+size_t formatStats(char *buffer, size_t size);
+
+#endif //__STATS_H__
\ No newline at end of file
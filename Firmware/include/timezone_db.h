@@ -0,0 +1,46 @@
+#ifndef __TIMEZONE_DB_H__
+#define __TIMEZONE_DB_H__
+
+#include <Arduino.h>
+
+#include "tzinfo.h"
+
+// the result of advancing the timezonedb.com query
+enum class TzFetchResult
+{
+  // the query is still running, call tzFetchService() again
+  Pending,
+  // the query finished and the out param was written
+  Succeeded,
+  // the query failed, the out param was not touched
+  Failed,
+};
+
+/**
+ * @brief start a new query of the timezone info from the timezonedb.com API
+ *
+ * The query runs as a state machine (connect, send, receive, parse)
+ * that is advanced by tzFetchService(). A running query is restarted
+ *
+ * @param zone the name of the zone to query (e.g. Europe/Berlin),
+ * names longer than 47 characters are truncated. The name is percent-encoded
+ */
+void tzFetchStart(const char *zone);
+
+/**
+ * @brief advance the running timezonedb.com query for a bounded time slice
+ *
+ * @param[out] out the struct to write the new timezone data to. Only written
+ * once a full, valid response has been parsed
+ * @param budgetUs the maximum time in µs to spend in this call. Connecting
+ * may take longer as the WiFiClient only connects blocking (bounded by a timeout)
+ * @return the state of the query
+ */
+TzFetchResult tzFetchService(TzInfo *out, uint32_t budgetUs);
+
+/**
+ * @return true if a query was started and is not yet finished
+ */
+bool tzFetchRunning();
+
+#endif //__TIMEZONE_DB_H__
\ No newline at end of file
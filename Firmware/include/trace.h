@@ -0,0 +1,105 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <Arduino.h>
+
+// A ring buffer of events in the RTC user memory. It survives soft resets
+// (ESP.restart(), WDT, exceptions), so the events leading to a reset can be
+// read after the boot. A power loss clears it. Tracing an event only takes
+// a few stores, it is always compiled in and safe to call from anywhere but ISRs
+
+// the events of the trace, the value of arg depends on the event
+enum class TraceEvent : uint8_t
+{
+  // arg: the reason of the reset (REASON_* of user_interface.h)
+  Boot = 1,
+  // the WiFi is connected and the network services are started
+  NetworkUp,
+  // arg: the NTPSyncEvent_t of the NTPClient (0: synced)
+  NtpSync,
+  // arg: the network delay of the measurement in ms
+  PhaseMeasured,
+  TzFetchSucceeded,
+  // arg: the number of failures in a row
+  TzFetchFailed,
+  WifiReconnect,
+  // ESP.restart() after too many failures, the Boot event follows
+  Reboot,
+  // arg: the time since the last loop() iteration in ms
+  LoopStall,
+  // arg: the FleetRole
+  FleetRole,
+  OtaStart,
+  // arg: the ota_error_t
+  OtaError,
+  ConfigSaved,
+};
+
+/**
+ * @brief an event of the trace
+ */
+typedef struct
+{
+  /**
+   * @brief the time of the event as unix timestamp (UTC), 0 if the
+   * time was not known yet
+   */
+  uint32_t utc;
+
+  TraceEvent event;
+
+  /**
+   * @brief the number of the boot the event happened in (wraps at 256)
+   */
+  uint8_t boot;
+
+  uint16_t arg;
+} TraceRecord;
+
+// the number of events kept, the oldest is overwritten
+const uint8_t traceCapacity = 44;
+
+/**
+ * @brief keep the trace of the previous boots (or clear it after a power-on)
+ * and trace the Boot event
+ *
+ * @param resetReason the reason of the reset (ESP.getResetInfoPtr()->reason)
+ */
+void traceBegin(uint32_t resetReason);
+
+/**
+ * @brief set the time of the events traced from now on, call once per second
+ *
+ * @param utc the current time as unix timestamp (UTC)
+ */
+void traceSetTime(time_t utc);
+
+/**
+ * @brief trace an event
+ */
+void trace(TraceEvent event, uint16_t arg = 0);
+
+/**
+ * @return the number of events in the trace
+ */
+uint8_t traceCount();
+
+/**
+ * @brief read an event of the trace
+ *
+ * @param index the index of the event, 0 is the oldest
+ * @param[out] out the event, only written if the index is valid
+ * @return true if the out param was written
+ */
+bool traceRead(uint8_t index, TraceRecord *out);
+
+/**
+ * @brief format an event as JSON object
+ *
+ * @param[out] buffer the buffer to write the null-terminated JSON to
+ * @param size the size of the buffer
+ * @return the length of the JSON (may be larger than the buffer if it was truncated)
+ */
+size_t formatTraceRecord(const TraceRecord &record, char *buffer, size_t size);
+
+#endif //__TRACE_H__
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef __TZ_RULE_H__
+#define __TZ_RULE_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "tzinfo.h"
+
+/**
+ * @brief the day of a year a DST transition happens on
+ */
+typedef struct
+{
+  /**
+   * @brief the format the day is specified in
+   * 'J': day of the year 1..365, February 29th is never counted
+   * 'D': zero-based day of the year 0..365, February 29th is counted
+   * 'M': the day of the week in a week of a month
+   */
+  char type;
+
+  /**
+   * @brief the day of the year ('J', 'D') or month 1..12 ('M')
+   */
+  uint16_t day;
+
+  /**
+   * @brief week of the month 1..5, 5 is the last week ('M' only)
+   */
+  uint8_t week;
+
+  /**
+   * @brief day of the week 0..6, 0 is sunday ('M' only)
+   */
+  uint8_t weekday;
+
+  /**
+   * @brief local time of the transition in seconds after midnight,
+   * may be negative or exceed one day
+   */
+  int32_t time;
+} TzTransitionRule;
+
+/**
+ * @brief a timezone parsed from a POSIX TZ string
+ * e.g. CET-1CEST,M3.5.0,M10.5.0/3 for Europe/Berlin
+ */
+typedef struct
+{
+  /**
+   * @brief the offset to GMT during standard time in seconds (east positive)
+   */
+  int32_t stdOffset;
+
+  /**
+   * @brief the offset to GMT during DST in seconds (east positive)
+   */
+  int32_t dstOffset;
+
+  /**
+   * @brief false if the zone does not observe DST
+   */
+  bool hasDst;
+
+  /**
+   * @brief the transition from standard time to DST
+   */
+  TzTransitionRule start;
+
+  /**
+   * @brief the transition from DST to standard time
+   */
+  TzTransitionRule end;
+} TzRule;
+
+/**
+ * @brief parse a POSIX TZ string
+ *
+ * @param posix the TZ string, e.g. CET-1CEST,M3.5.0,M10.5.0/3
+ * @param[out] out the parsed rule
+ * @return true if the string was valid and the out param is written
+ * @return false otherwise
+ */
+bool parseTzRule(const char *posix, TzRule *out);
+
+/**
+ * @brief compute the timezone info for a point in time from a rule
+ *
+ * @param rule the rule of the timezone
+ * @param utc the point in time as unix timestamp (UTC)
+ * @param[out] out the offset and DST state at that time, valid until the
+ * next transition (or a year if the zone does not observe DST)
+ */
+void getTzRuleInfo(const TzRule &rule, time_t utc, TzInfo *out);
+
+#endif //__TZ_RULE_H__
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef __TZINFO_H__
+#define __TZINFO_H__
+
+#include <stdint.h>
+#include <time.h>
+
+typedef struct
+{
+  /**
+   * @brief dstInEffect a boolean indicating whether DST is currently active
+   */
+  bool dstInEffect;
+
+  /**
+   * @brief the current offset to GMT
+   */
+  int32_t offset;
+
+  /**
+   * @brief the currently requested data is valid until this unix timestamp (UTC)
+   */
+  time_t validUntil;
+} TzInfo;
+
+#endif //__TZINFO_H__
\ No newline at end of file
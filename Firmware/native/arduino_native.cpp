@@ -0,0 +1,28 @@
+#include <Arduino.h>
+
+#include <chrono>
+
+EspClass ESP;
+
+// the time all the clocks are relative to
+static const std::chrono::steady_clock::time_point startedAt = std::chrono::steady_clock::now();
+
+static uint64_t nanosSinceStart()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startedAt).count();
+}
+
+uint32_t millis()
+{
+  return nanosSinceStart() / 1000000;
+}
+
+uint32_t micros()
+{
+  return nanosSinceStart() / 1000;
+}
+
+uint32_t EspClass::getCycleCount()
+{
+  return nanosSinceStart() * getCpuFreqMHz() / 1000;
+}
\ No newline at end of file
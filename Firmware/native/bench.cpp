@@ -0,0 +1,524 @@
+// Checks and benchmarks of the display encoding and refresh on the host.
+// Build and run with: pio run -e native -t exec
+//
+// The checks integrate the time every output of the simulated chain is on
+// during a refresh period, so both the encoding of the frames and the brightness
+// masking of the engine are verified. A model of the TimeLib clock checks that
+// the displayed second flips at the measured phase while the NTPClient keeps
+// syncing. Exits with 1 if a check failed.
+// The trace report shows the duty cycle, refresh rate and the transitions
+// between the cathodes of the tubes while the minutes change.
+// The timings are host timings, they only allow to compare changes.
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "display.h"
+#include "display_gamma.h"
+#include "native_hal.h"
+#include "second_phase.h"
+#include "stats.h"
+#include "tpic6b595_sim.h"
+#include "trace_analysis.h"
+
+// number of frames shifted out per refresh period of the engine
+const uint32_t framesPerPeriod = displayEngine == DisplayEngine::Bcm ? bcmBits : maxBrightness + 1;
+
+// number of brightness steps a period is divided into
+const uint32_t stepsPerPeriod = displayEngine == DisplayEngine::Bcm ? maxBrightness : maxBrightness + 1;
+
+// number of iterations of the benchmarks
+const uint32_t encodeIterations = 100000;
+const uint32_t periodIterations = 10000;
+
+/**
+ * @brief run the refresh for a whole period like the timer would
+ *
+ * An idle BCM shows every frame for a whole period, then this runs
+ * for framesPerPeriod periods of the same outputs
+ *
+ * @return the time the last frame of the period is shown until
+ */
+static uint32_t runPeriod()
+{
+  uint32_t ticks = 0;
+  for (uint32_t frame = 0; frame < framesPerPeriod; frame++)
+  {
+    ticks = nativeTimerFire();
+  }
+  return nativeTimerNow() + ticks;
+}
+
+/**
+ * @brief run the refresh for whole periods until some time passed
+ *
+ * @return the time the last frame is shown until
+ */
+static uint32_t runFor(uint32_t ms)
+{
+  uint32_t start = nativeTimerNow();
+  uint32_t endTicks = start;
+  while (endTicks - start < ms * 1000 * displayTimerTicksPerUs)
+  {
+    endTicks = runPeriod();
+  }
+  return endTicks;
+}
+
+/**
+ * @brief run the refresh until a crossfade is done
+ *
+ * The chain is not simulated in the meantime to save time
+ */
+static void settle()
+{
+  nativeBusSimulate(false);
+  runFor(crossfadeMs + 10);
+  nativeBusSimulate(true);
+
+  // the first latch shows the data shifted before the simulation was off
+  runPeriod();
+}
+
+/**
+ * @brief light an output in the bytes of the serial stream (see P2B())
+ */
+static void setStreamBit(uint8_t *stream, uint8_t bit)
+{
+  stream[bit / 8] |= 1 << (bit % 8);
+}
+
+/**
+ * @brief the expected outputs in the order of the serial stream, straight from the pinmaps
+ */
+static void referenceStream(const tmElements_t &time, uint8_t dots, uint8_t *stream)
+{
+  memset(stream, 0x00, numChips);
+  uint8_t digits[numDigits];
+  timeToDigits(time, digits);
+  for (uint8_t digit = 0; digit < numDigits; digit++)
+  {
+    setStreamBit(stream, digitsPinmap[digit][digits[digit]]);
+  }
+  for (uint8_t dot = 0; dot < numDigits; dot++)
+  {
+    if ((dots >> dot) & 0b1)
+    {
+      setStreamBit(stream, dotsPinmap[dot]);
+    }
+  }
+  if (time.Second % 2)
+  {
+    setStreamBit(stream, ledsPinmap[0]);
+    setStreamBit(stream, ledsPinmap[1]);
+  }
+}
+
+/**
+ * @brief check if an output of the serial stream drives a cathode
+ */
+static bool isDigitBit(uint8_t bit)
+{
+  for (uint8_t digit = 0; digit < numDigits; digit++)
+  {
+    for (uint8_t number = 0; number < 10; number++)
+    {
+      if (digitsPinmap[digit][number] == bit)
+      {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief check if an output of the serial stream drives a colon LED
+ */
+static bool isLedBit(uint8_t bit)
+{
+  return ledsPinmap[0] == bit || ledsPinmap[1] == bit;
+}
+
+/**
+ * @brief show a time at a brightness and compare the duty cycle of every
+ * output with the reference
+ *
+ * @return the number of outputs with a wrong duty cycle
+ */
+static uint32_t checkDisplay(const tmElements_t &time, uint8_t dots, uint8_t digits, uint8_t leds)
+{
+  // the BCM planes are only updated once the last ones were picked up,
+  // which takes a period at most
+  setDisplayBrightness(digits, leds);
+  runPeriod();
+  setDisplay(time, dots);
+  settle();
+
+  simTraceClear();
+  TraceDuty duty;
+  traceDuty(runPeriod(), &duty);
+
+  uint8_t stream[numChips];
+  referenceStream(time, dots, stream);
+  uint32_t errors = 0;
+  for (uint8_t bit = 0; bit < numChips * 8; bit++)
+  {
+    // the dots are not dimmed
+    uint32_t brightness = isDigitBit(bit) ? digits : (isLedBit(bit) ? leds : stepsPerPeriod);
+    uint64_t expected = simOutputOn(stream, bit) ? (uint64_t)duty.totalTicks * brightness : 0;
+    if ((uint64_t)duty.onTicks[bit] * stepsPerPeriod != expected)
+    {
+      printf("FAIL %02u:%02u:%02u dots %02x brightness %u/%u: bit %u on %u of %u ticks\n",
+             time.Hour, time.Minute, time.Second, dots, digits, leds,
+             bit, duty.onTicks[bit], duty.totalTicks);
+      errors++;
+    }
+  }
+  return errors;
+}
+
+/**
+ * @brief show a perceptual level and compare the duty cycle of the digits
+ * and LEDs averaged over a dither cycle with the gamma corrected duty
+ *
+ * @return the number of outputs with a wrong duty cycle
+ */
+static uint32_t checkLevel(const tmElements_t &time, uint16_t level)
+{
+  setDisplayLevel(level, maxDisplayLevel - level);
+  runPeriod();
+  runPeriod();
+
+  // every period of the dither cycle is shown once in any ditherPhases
+  // consecutive periods
+  simTraceClear();
+  uint32_t endTicks = 0;
+  for (uint8_t phase = 0; phase < ditherPhases; phase++)
+  {
+    endTicks = runPeriod();
+  }
+  TraceDuty duty;
+  traceDuty(endTicks, &duty);
+
+  uint8_t stream[numChips];
+  referenceStream(time, 0x00, stream);
+  uint32_t errors = 0;
+  for (uint8_t bit = 0; bit < numChips * 8; bit++)
+  {
+    if (!simOutputOn(stream, bit) || !(isDigitBit(bit) || isLedBit(bit)))
+    {
+      continue;
+    }
+    uint16_t expectedDuty = levelToDuty(isDigitBit(bit) ? level : maxDisplayLevel - level);
+    if ((uint64_t)duty.onTicks[bit] * (stepsPerPeriod << ditherBits) != (uint64_t)duty.totalTicks * expectedDuty)
+    {
+      printf("FAIL level %u: bit %u on %u of %u ticks, expected duty %u/%u\n",
+             level, bit, duty.onTicks[bit], duty.totalTicks, expectedDuty, stepsPerPeriod << ditherBits);
+      errors++;
+    }
+  }
+  return errors;
+}
+
+/**
+ * @brief change the minutes and check that the old and the new digit of every
+ * tube are crossfaded without ever being lit at the same time
+ *
+ * @param republish true to set the brightness again before the refresh picked
+ * up the new digits, as a brightness change during a crossfade does
+ * @return the number of tubes with a wrong crossfade
+ */
+static uint32_t checkCrossfade(uint8_t brightness, bool republish = false)
+{
+  tmElements_t time = {};
+  time.Hour = 12;
+  time.Minute = 59;
+  setDisplayBrightness(brightness, brightness);
+  runPeriod();
+  setDisplay(time);
+  settle();
+
+  simTraceClear();
+  time.Hour = 13;
+  time.Minute = 0;
+  setDisplay(time);
+  if (republish)
+  {
+    setDisplayBrightness(brightness, brightness);
+  }
+  uint32_t endTicks = runFor(crossfadeMs + 10);
+
+  TraceDuty duty;
+  traceDuty(endTicks, &duty);
+  TraceGhosting ghosting[numDigits];
+  traceGhosting(endTicks, ghosting);
+
+  uint32_t errors = 0;
+  for (uint8_t digit = 0; digit < numDigits; digit++)
+  {
+    // the tube is lit as long as without a crossfade
+    uint32_t onTicks = 0;
+    for (uint8_t number = 0; number < 10; number++)
+    {
+      onTicks += duty.onTicks[digitsPinmap[digit][number]];
+    }
+    // the digits 2, 0 and 1 of 13:00 change, a hard switch would be a
+    // single switch instead of alternating the digits for every step
+    bool fadeExpected = digit > 0 && digit < 4 && brightness > 0;
+    if (ghosting[digit].overlapTicks > 0 || (uint64_t)onTicks * stepsPerPeriod != (uint64_t)duty.totalTicks * brightness ||
+        (fadeExpected && ghosting[digit].switches < 8))
+    {
+      printf("FAIL crossfade of tube %u at brightness %u%s: on %u of %u ticks, %u switches, %u ticks overlap\n",
+             digit, brightness, republish ? " (republished)" : "", onTicks, duty.totalTicks, ghosting[digit].switches, ghosting[digit].overlapTicks);
+      errors++;
+    }
+  }
+  return errors;
+}
+
+/**
+ * @brief the clock of TimeLib: the seconds count from the last setTime(),
+ * now() calls the sync provider once the sync interval passed since then
+ */
+typedef struct
+{
+  time_t sysTime;
+  uint32_t prevMillis;
+  time_t nextSyncTime;
+  uint32_t syncs;
+} ClockModel;
+
+/**
+ * @brief now() of TimeLib at the passed millis()
+ *
+ * @param ntpUtc the whole second the NTPClient returns when it syncs
+ */
+static time_t modelNow(ClockModel *clock, uint32_t ms, time_t ntpUtc)
+{
+  const time_t syncInterval = 63;
+  while (ms - clock->prevMillis >= 1000)
+  {
+    clock->sysTime++;
+    clock->prevMillis += 1000;
+  }
+  if (clock->nextSyncTime <= clock->sysTime)
+  {
+    clock->syncs++;
+    clock->sysTime = ntpUtc;
+    clock->prevMillis = ms;
+    clock->nextSyncTime = ntpUtc + syncInterval;
+  }
+  return clock->sysTime;
+}
+
+/**
+ * @brief check that the displayed second flips at the measured start of
+ * the second while the NTPClient keeps syncing
+ */
+static uint32_t checkSecondPhase()
+{
+  // the UTC seconds start 630ms into every second of millis()
+  const uint32_t phaseMs = 630;
+  const time_t startUtc = 1700000000;
+  const uint32_t durationMs = 10 * 60 * 1000;
+
+  SecondPhase phase = {true, startUtc, phaseMs, 20};
+  ClockModel clock = {0, 0, 0, 0};
+  uint32_t errors = 0;
+  time_t shown = 0;
+  for (uint32_t ms = 0; ms < durationMs; ms++)
+  {
+    time_t utc = startUtc - 1 + (ms + 1000 - phaseMs) / 1000;
+    time_t local = phaseLocalTime(phase, ms, modelNow(&clock, ms, utc), 0);
+    if (local != utc)
+    {
+      errors++;
+    }
+    if (local != shown && ms > 0 && ms % 1000 != phaseMs)
+    {
+      errors++;
+    }
+    shown = local;
+  }
+
+  // the sync at the start and every 63s after it
+  uint32_t expectedSyncs = 1 + durationMs / 1000 / 63;
+  if (clock.syncs != expectedSyncs)
+  {
+    printf("%u NTP syncs instead of %u with the measured phase\n", clock.syncs, expectedSyncs);
+    errors++;
+  }
+  if (errors)
+  {
+    printf("the displayed second does not flip at the measured start of the second\n");
+  }
+  return errors;
+}
+
+static uint32_t runChecks()
+{
+  uint32_t errors = 0;
+  tmElements_t time = {};
+
+  // every time with the colon on and off and every dot
+  for (uint8_t hour = 0; hour < 24; hour++)
+  {
+    for (uint8_t minute = 0; minute < 60; minute++)
+    {
+      time.Hour = hour;
+      time.Minute = minute;
+      time.Second = minute;
+      errors += checkDisplay(time, 1 << (minute % numDigits), maxBrightness, maxBrightness);
+    }
+  }
+
+  // every brightness, the digits and LEDs are masked separately
+  time.Hour = 12;
+  time.Minute = 34;
+  time.Second = 1;
+  for (uint16_t brightness = 0; brightness <= maxBrightness; brightness++)
+  {
+    errors += checkDisplay(time, 0x0F, brightness, maxBrightness - brightness);
+  }
+
+  // the dithered perceptual levels
+  setDisplay(time);
+  settle();
+  for (uint32_t level = 0; level <= maxDisplayLevel; level += 7)
+  {
+    errors += checkLevel(time, level);
+  }
+
+  // the crossfade only uses the planes of the brightness with the BCM
+  errors += checkCrossfade(maxBrightness);
+  errors += checkCrossfade(maxBrightness * 2 / 3);
+  errors += checkCrossfade(maxBrightness / 5);
+  errors += checkCrossfade(maxBrightness * 2 / 3, true);
+
+  errors += checkSecondPhase();
+
+  return errors;
+}
+
+/**
+ * @brief print the duty cycle and refresh rate of the lit cathodes and the
+ * transitions between the cathodes while the minutes are crossfaded
+ */
+static void runTraceReport()
+{
+  const uint8_t brightness = maxBrightness / 3;
+  const uint32_t periods = 20;
+
+  tmElements_t time = {};
+  time.Hour = 12;
+  time.Minute = 59;
+  setDisplayBrightness(brightness, brightness);
+  runPeriod();
+  setDisplay(time);
+  settle();
+
+  simTraceClear();
+  uint32_t frames = stats.frames;
+  uint32_t shifts = stats.shifts;
+  for (uint32_t period = 0; period < periods; period++)
+  {
+    runPeriod();
+  }
+  time.Hour = 13;
+  time.Minute = 0;
+  setDisplay(time);
+  uint32_t endTicks = runFor(crossfadeMs + 10);
+  frames = stats.frames - frames;
+  shifts = stats.shifts - shifts;
+
+  TraceDuty duty;
+  traceDuty(endTicks, &duty);
+  TraceGhosting ghosting[numDigits];
+  traceGhosting(endTicks, ghosting);
+
+  printf("trace of 12:59 -> 13:00 at brightness %u/%u, %u frames over %u us, %u of %u frames shifted out\n",
+         brightness, maxBrightness, simTraceLength(), duty.totalTicks / displayTimerTicksPerUs, shifts, frames);
+  for (uint8_t digit = 0; digit < numDigits; digit++)
+  {
+    printf("tube %u:", digit);
+    for (uint8_t number = 0; number < 10; number++)
+    {
+      uint8_t bit = digitsPinmap[digit][number];
+      if (duty.onTicks[bit])
+      {
+        printf(" [%u] %.1f%% %.0fHz", number, 100.0f * duty.onTicks[bit] / duty.totalTicks, traceRefreshHz(duty, bit));
+      }
+    }
+    printf(", %u switches, %u direct, %u ticks overlap\n",
+           ghosting[digit].switches, ghosting[digit].directSwitches, ghosting[digit].overlapTicks);
+  }
+}
+
+/**
+ * @brief ns per iteration of a function
+ */
+template <typename F>
+static double measureNs(uint32_t iterations, F function)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    function(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+static void runBenchmarks()
+{
+  nativeBusSimulate(false);
+  setDisplayBrightness(maxBrightness / 2, maxBrightness / 3);
+
+  double periodNs = measureNs(periodIterations, [](uint32_t) { runPeriod(); });
+
+  // the BCM only accepts new planes once per period, so the encoding
+  // is measured together with a period and the period is subtracted
+  const bool waitForPeriod = displayEngine == DisplayEngine::Bcm;
+  double encodeNs = measureNs(encodeIterations, [waitForPeriod](uint32_t i) {
+    tmElements_t time = {};
+    time.Hour = i % 24;
+    time.Minute = i % 60;
+    time.Second = i % 2;
+    setDisplay(time, i % 16);
+    if (waitForPeriod)
+    {
+      runPeriod();
+    }
+  }) - (waitForPeriod ? periodNs : 0);
+
+  printf("engine: %s, variant: IN-%u, bus: %s\n",
+         displayEngine == DisplayEngine::Bcm ? "BCM" : "PWM", Variant::tube,
+         displayBusUsesHardwareSpi ? "HSPI" : "bit-banged");
+  printf("frame encode: %.1f ns\n", encodeNs);
+  printf("refresh period (%u frames): %.1f ns, %.1f ns per frame\n",
+         framesPerPeriod, periodNs, periodNs / framesPerPeriod);
+}
+
+int main()
+{
+  displayBegin();
+  // let the ISR pick up the initial planes
+  runPeriod();
+
+  uint32_t errors = runChecks();
+  if (errors)
+  {
+    printf("%u checks failed\n", errors);
+    return 1;
+  }
+  printf("all checks passed\n");
+
+  runTraceReport();
+  runBenchmarks();
+  return 0;
+}
\ No newline at end of file
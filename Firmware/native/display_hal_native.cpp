@@ -0,0 +1,91 @@
+#include "display_hal.h"
+#include "native_hal.h"
+#include "tpic6b595_sim.h"
+
+// false to skip the simulation of the chain
+static bool busSimulated = true;
+
+// the state of the simulated timer1
+static void (*timerIsr)() = nullptr;
+static bool timerPeriodic = false;
+static bool timerArmed = false;
+static uint32_t timerTicks = 0;
+static uint32_t timerNow = 0;
+
+void displayBusBegin()
+{
+  simChainReset();
+  simChainWrite(latchPin, true);
+}
+
+void displayBusLatch()
+{
+  if (!busSimulated)
+  {
+    return;
+  }
+  simChainWrite(latchPin, false);
+  simChainWrite(latchPin, true);
+}
+
+void displayBusShift(const uint8_t *frame)
+{
+  // the display skips shifting out frames the registers already hold,
+  // so they have to be up-to-date even without the simulation
+  if (!busSimulated)
+  {
+    simChainLoad(frame);
+    return;
+  }
+
+  // the same sequence as the bit-banged bus on the device
+  for (uint8_t chip = 0; chip < numChips; chip++)
+  {
+    for (int8_t bit = 7; bit >= 0; bit--)
+    {
+      simChainWrite(dataPin, (frame[chip] >> bit) & 0b1);
+      simChainWrite(clockPin, true);
+      simChainWrite(clockPin, false);
+    }
+  }
+}
+
+void displayTimerBegin(void (*isr)(), bool periodic)
+{
+  timerIsr = isr;
+  timerPeriodic = periodic;
+  timerArmed = false;
+}
+
+void displayTimerArm(uint32_t ticks)
+{
+  timerTicks = ticks;
+  timerArmed = true;
+}
+
+uint32_t nativeTimerFire()
+{
+  if (timerIsr == nullptr || !timerArmed)
+  {
+    return 0;
+  }
+
+  // the ISR runs once the armed ticks passed
+  timerNow += timerTicks;
+  simChainSetTime(timerNow);
+
+  // a one-shot timer has to be re-armed by the ISR
+  timerArmed = timerPeriodic;
+  timerIsr();
+  return timerArmed ? timerTicks : 0;
+}
+
+uint32_t nativeTimerNow()
+{
+  return timerNow;
+}
+
+void nativeBusSimulate(bool simulate)
+{
+  busSimulated = simulate;
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#ifndef __NATIVE_ARDUINO_H__
+#define __NATIVE_ARDUINO_H__
+
+// the parts of the Arduino core used by the display code,
+// so it can be compiled and benchmarked on the host
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <type_traits>
+
+// there is no IRAM on the host
+#define IRAM_ATTR
+
+template <typename T, typename U>
+inline typename std::common_type<T, U>::type min(T a, U b)
+{
+  return a < b ? a : b;
+}
+
+template <typename T, typename U>
+inline typename std::common_type<T, U>::type max(T a, U b)
+{
+  return a > b ? a : b;
+}
+
+/**
+ * @brief ms since the start of the program
+ */
+uint32_t millis();
+
+/**
+ * @brief µs since the start of the program
+ */
+uint32_t micros();
+
+// there is no ISR running concurrently on the host,
+// the refresh is driven by the benchmark
+inline void noInterrupts()
+{
+}
+
+inline void interrupts()
+{
+}
+
+class EspClass
+{
+public:
+  /**
+   * @brief the host has no cycle counter with a fixed frequency,
+   * the counter is derived from the time with the ESP8266 CPU frequency
+   */
+  uint32_t getCycleCount();
+
+  uint8_t getCpuFreqMHz()
+  {
+    return 80;
+  }
+
+  /**
+   * @brief the host has no heap of the ESP8266, the values of a freshly
+   * booted clock
+   */
+  uint32_t getFreeHeap()
+  {
+    return 40000;
+  }
+
+  uint32_t getMaxFreeBlockSize()
+  {
+    return 38000;
+  }
+
+  uint8_t getHeapFragmentation()
+  {
+    return 5;
+  }
+};
+
+extern EspClass ESP;
+
+#endif //__NATIVE_ARDUINO_H__
\ No newline at end of file
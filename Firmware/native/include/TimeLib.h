@@ -0,0 +1,21 @@
+#ifndef __NATIVE_TIMELIB_H__
+#define __NATIVE_TIMELIB_H__
+
+// the time struct of the Time library, same layout as on the device
+
+#include <stdint.h>
+
+typedef struct
+{
+  uint8_t Second;
+  uint8_t Minute;
+  uint8_t Hour;
+  // day of week, sunday is day 1
+  uint8_t Wday;
+  uint8_t Day;
+  uint8_t Month;
+  // offset from 1970
+  uint8_t Year;
+} tmElements_t;
+
+#endif //__NATIVE_TIMELIB_H__
\ No newline at end of file
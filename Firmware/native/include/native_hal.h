@@ -0,0 +1,31 @@
+#ifndef __NATIVE_HAL_H__
+#define __NATIVE_HAL_H__
+
+#include <stdint.h>
+
+// The display HAL of the host build: the pins drive the simulated chain of
+// shift registers and the timer1 ISR is called by the benchmark instead of
+// the hardware.
+
+/**
+ * @brief run the ISR attached by displayTimerBegin() like the timer would
+ *
+ * @return the ticks until the timer fires next, i.e. the time the outputs
+ * latched by the ISR are shown. 0 if the ISR did not re-arm a one-shot timer
+ */
+uint32_t nativeTimerFire();
+
+/**
+ * @brief the simulated time of the last run of the ISR in timer ticks
+ */
+uint32_t nativeTimerNow();
+
+/**
+ * @brief enable or disable the simulation of the chain
+ *
+ * The bus does nothing while the simulation is disabled, so the benchmarks
+ * only measure the display code and not the simulation
+ */
+void nativeBusSimulate(bool simulate);
+
+#endif //__NATIVE_HAL_H__
\ No newline at end of file
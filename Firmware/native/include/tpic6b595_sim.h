@@ -0,0 +1,95 @@
+#ifndef __TPIC6B595_SIM_H__
+#define __TPIC6B595_SIM_H__
+
+#include <stdint.h>
+
+#include "pins.h"
+
+// Simulation of the chain of TPIC6B595 shift registers driven by the
+// latchPin, clockPin and dataPin. Every frame latched into the outputs
+// is recorded with its timestamp in a ring buffer, the trace.
+
+// number of latched frames kept in the trace
+// (a crossfade of the PWM takes ~5000 frames)
+const uint16_t traceCapacity = 8192;
+
+/**
+ * @brief a frame latched into the outputs of the chain
+ */
+typedef struct
+{
+  /**
+   * @brief the time of the latch in timer ticks (displayTimerTicksPerUs per µs)
+   */
+  uint32_t ticks;
+
+  /**
+   * @brief the outputs in the order of the serial stream: bit P2B(chip, pin)
+   * is bit (pin) of byte (chip - 1)
+   */
+  uint8_t outputs[numChips];
+} TraceEntry;
+
+/**
+ * @brief clear the shift registers, the outputs and the trace
+ */
+void simChainReset();
+
+/**
+ * @brief set the time of the following pin changes
+ *
+ * @param ticks the time in timer ticks
+ */
+void simChainSetTime(uint32_t ticks);
+
+/**
+ * @brief change the level of a pin connected to the chain
+ *
+ * A rising edge of the clock shifts in the data pin, a rising edge of the
+ * latch copies the shift registers into the outputs and records the frame
+ */
+void simChainWrite(uint8_t pin, bool level);
+
+/**
+ * @brief load the shift registers at once, without simulating the pin changes
+ *
+ * The same as shifting out the frame bit by bit, but fast
+ *
+ * @param frame numChips bytes in the order they are shifted out
+ */
+void simChainLoad(const uint8_t *frame);
+
+/**
+ * @brief the current state of the outputs, in the order of the serial stream
+ */
+const uint8_t *simChainOutputs();
+
+/**
+ * @brief the number of frames in the trace
+ */
+uint16_t simTraceLength();
+
+/**
+ * @brief a frame of the trace
+ *
+ * @param index 0 for the oldest frame up to simTraceLength() - 1
+ */
+const TraceEntry &simTraceEntry(uint16_t index);
+
+/**
+ * @brief drop all frames of the trace, the outputs are kept
+ */
+void simTraceClear();
+
+/**
+ * @brief true if an output is on in a frame
+ *
+ * @param outputs the outputs in the order of the serial stream
+ * @param bit the bit in the serial stream as returned by P2B()
+ */
+inline bool simOutputOn(const uint8_t *outputs, uint8_t bit)
+{
+  return (outputs[bit / 8] >> (bit % 8)) & 0b1;
+}
+
+#endif //__TPIC6B595_SIM_H__
\ No newline at end of file
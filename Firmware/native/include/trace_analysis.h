@@ -0,0 +1,82 @@
+#ifndef __TRACE_ANALYSIS_H__
+#define __TRACE_ANALYSIS_H__
+
+#include <stdint.h>
+
+#include "tpic6b595_sim.h"
+
+// Analysis of the frames recorded by the simulated chain. Every frame of the
+// trace is shown until the next one is latched, the last one until endTicks.
+
+/**
+ * @brief the time every output of the chain was on
+ */
+typedef struct
+{
+  /**
+   * @brief the ticks an output was on, indexed by the bit in the serial stream
+   */
+  uint32_t onTicks[numChips * 8];
+
+  /**
+   * @brief the number of times an output was switched on
+   */
+  uint32_t onEdges[numChips * 8];
+
+  /**
+   * @brief the ticks covered by the trace
+   */
+  uint32_t totalTicks;
+} TraceDuty;
+
+/**
+ * @brief the transitions between the cathodes of a tube
+ */
+typedef struct
+{
+  /**
+   * @brief the number of times the tube switched to another cathode
+   */
+  uint32_t switches;
+
+  /**
+   * @brief the number of switches with no frame in between in which the tube
+   * was dark. The charge of the old cathode lights up the new one briefly
+   */
+  uint32_t directSwitches;
+
+  /**
+   * @brief the shortest time the tube was dark between two cathodes
+   * in ticks, UINT32_MAX if the tube never switched
+   */
+  uint32_t minBlankTicks;
+
+  /**
+   * @brief the ticks more than one cathode of the tube was on at once
+   */
+  uint32_t overlapTicks;
+} TraceGhosting;
+
+/**
+ * @brief compute the on time of every output over the trace
+ *
+ * @param endTicks the time the last frame of the trace was shown until
+ */
+void traceDuty(uint32_t endTicks, TraceDuty *out);
+
+/**
+ * @brief find the transitions between the cathodes of every tube
+ *
+ * @param endTicks the time the last frame of the trace was shown until
+ * @param[out] out the transitions of every tube, numDigits entries
+ */
+void traceGhosting(uint32_t endTicks, TraceGhosting *out);
+
+/**
+ * @brief the frequency an output is switched on with, averaged over the trace
+ *
+ * @return the frequency in Hz, 0 if the output was constantly on or off
+ */
+float traceRefreshHz(const TraceDuty &duty, uint8_t bit);
+
+#endif //__TRACE_ANALYSIS_H__
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "tpic6b595_sim.h"
+
+#include <string.h>
+
+// the shift registers and the storage registers (outputs) of the chain,
+// in the order of the serial stream
+static uint8_t shiftRegisters[numChips];
+static uint8_t outputs[numChips];
+
+// the last level of the pins, the chain reacts on the rising edges
+static bool clockLevel = false;
+static bool latchLevel = false;
+static bool dataLevel = false;
+
+static uint32_t now = 0;
+
+// the ring buffer of the latched frames
+static TraceEntry trace[traceCapacity];
+static uint16_t traceStart = 0;
+static uint16_t traceLength = 0;
+
+void simChainReset()
+{
+  memset(shiftRegisters, 0x00, numChips);
+  memset(outputs, 0x00, numChips);
+  clockLevel = false;
+  latchLevel = false;
+  dataLevel = false;
+  simTraceClear();
+}
+
+void simChainSetTime(uint32_t ticks)
+{
+  now = ticks;
+}
+
+/**
+ * @brief shift the data into the first output of the first chip,
+ * every output moves on by one, the last output of the last chip drops out
+ */
+static void shiftIn(bool data)
+{
+  for (int8_t chip = numChips - 1; chip >= 0; chip--)
+  {
+    uint8_t carry = chip > 0 ? shiftRegisters[chip - 1] >> 7 : data;
+    shiftRegisters[chip] = (shiftRegisters[chip] << 1) | carry;
+  }
+}
+
+/**
+ * @brief copy the shift registers to the outputs and record the frame
+ */
+static void latch()
+{
+  memcpy(outputs, shiftRegisters, numChips);
+
+  // overwrite the oldest frame once the trace is full
+  TraceEntry *entry;
+  if (traceLength < traceCapacity)
+  {
+    entry = &trace[(traceStart + traceLength++) % traceCapacity];
+  }
+  else
+  {
+    entry = &trace[traceStart];
+    traceStart = (traceStart + 1) % traceCapacity;
+  }
+  entry->ticks = now;
+  memcpy(entry->outputs, outputs, numChips);
+}
+
+void simChainWrite(uint8_t pin, bool level)
+{
+  if (pin == dataPin)
+  {
+    dataLevel = level;
+  }
+  else if (pin == clockPin)
+  {
+    if (level && !clockLevel)
+    {
+      shiftIn(dataLevel);
+    }
+    clockLevel = level;
+  }
+  else if (pin == latchPin)
+  {
+    if (level && !latchLevel)
+    {
+      latch();
+    }
+    latchLevel = level;
+  }
+}
+
+void simChainLoad(const uint8_t *frame)
+{
+  // the first byte shifted out ends up in the last chip
+  for (uint8_t chip = 0; chip < numChips; chip++)
+  {
+    shiftRegisters[numChips - 1 - chip] = frame[chip];
+  }
+}
+
+const uint8_t *simChainOutputs()
+{
+  return outputs;
+}
+
+uint16_t simTraceLength()
+{
+  return traceLength;
+}
+
+const TraceEntry &simTraceEntry(uint16_t index)
+{
+  return trace[(traceStart + index) % traceCapacity];
+}
+
+void simTraceClear()
+{
+  traceStart = 0;
+  traceLength = 0;
+}
\ No newline at end of file
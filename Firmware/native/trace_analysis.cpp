@@ -0,0 +1,106 @@
+#include "trace_analysis.h"
+
+#include <string.h>
+
+#include "display_hal.h"
+
+/**
+ * @brief the time a frame of the trace was shown
+ */
+static uint32_t shownTicks(uint16_t index, uint32_t endTicks)
+{
+  uint32_t until = index + 1 < simTraceLength() ? simTraceEntry(index + 1).ticks : endTicks;
+  return until - simTraceEntry(index).ticks;
+}
+
+void traceDuty(uint32_t endTicks, TraceDuty *out)
+{
+  memset(out, 0, sizeof(*out));
+
+  for (uint16_t index = 0; index < simTraceLength(); index++)
+  {
+    const uint8_t *outputs = simTraceEntry(index).outputs;
+    const uint8_t *previous = index > 0 ? simTraceEntry(index - 1).outputs : nullptr;
+    uint32_t ticks = shownTicks(index, endTicks);
+
+    for (uint8_t bit = 0; bit < numChips * 8; bit++)
+    {
+      if (!simOutputOn(outputs, bit))
+      {
+        continue;
+      }
+      out->onTicks[bit] += ticks;
+      if (previous != nullptr && !simOutputOn(previous, bit))
+      {
+        out->onEdges[bit]++;
+      }
+    }
+    out->totalTicks += ticks;
+  }
+}
+
+void traceGhosting(uint32_t endTicks, TraceGhosting *out)
+{
+  for (uint8_t digit = 0; digit < numDigits; digit++)
+  {
+    TraceGhosting ghosting = {0, 0, UINT32_MAX, 0};
+
+    // the cathode lit last and the ticks the tube is dark since
+    int8_t litCathode = -1;
+    uint32_t blankTicks = 0;
+
+    for (uint16_t index = 0; index < simTraceLength(); index++)
+    {
+      const uint8_t *outputs = simTraceEntry(index).outputs;
+      uint32_t ticks = shownTicks(index, endTicks);
+
+      int8_t cathode = -1;
+      uint8_t litCathodes = 0;
+      for (uint8_t number = 0; number < 10; number++)
+      {
+        if (simOutputOn(outputs, digitsPinmap[digit][number]))
+        {
+          cathode = number;
+          litCathodes++;
+        }
+      }
+
+      if (litCathodes > 1)
+      {
+        ghosting.overlapTicks += ticks;
+      }
+
+      if (litCathodes == 0)
+      {
+        blankTicks += ticks;
+        continue;
+      }
+
+      if (litCathode >= 0 && cathode != litCathode)
+      {
+        ghosting.switches++;
+        if (blankTicks == 0)
+        {
+          ghosting.directSwitches++;
+        }
+        if (blankTicks < ghosting.minBlankTicks)
+        {
+          ghosting.minBlankTicks = blankTicks;
+        }
+      }
+      litCathode = cathode;
+      blankTicks = 0;
+    }
+
+    out[digit] = ghosting;
+  }
+}
+
+float traceRefreshHz(const TraceDuty &duty, uint8_t bit)
+{
+  if (duty.totalTicks == 0)
+  {
+    return 0;
+  }
+  return duty.onEdges[bit] * (displayTimerTicksPerUs * 1000000.0f) / duty.totalTicks;
+}
\ No newline at end of file
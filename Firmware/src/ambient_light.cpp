@@ -0,0 +1,65 @@
+#include "ambient_light.h"
+
+// fractional bits of the moving average
+const uint8_t filterFractionBits = 4;
+
+bool ambientLightDue(const AmbientLight &light, uint32_t nowMs)
+{
+  // compare the difference to handle the overflow of millis()
+  return !light.started || (int32_t)(nowMs - light.nextSampleAt) >= 0;
+}
+
+/**
+ * @brief map a reading linearly to the levels of the config
+ */
+static uint16_t readingToLevel(const AmbientLightConfig &config, uint32_t reading)
+{
+  if (reading <= config.darkReading)
+  {
+    return config.minLevel;
+  }
+  if (reading >= config.brightReading)
+  {
+    return config.maxLevel;
+  }
+  return config.minLevel + (reading - config.darkReading) * (config.maxLevel - config.minLevel) /
+                               (config.brightReading - config.darkReading);
+}
+
+bool ambientLightUpdate(AmbientLight *light, const AmbientLightConfig &config, uint16_t reading, uint32_t nowMs)
+{
+  light->nextSampleAt = nowMs + config.sampleIntervalMs;
+
+  uint32_t sample = (uint32_t)reading << filterFractionBits;
+  if (!light->started)
+  {
+    // start from the first reading instead of fading in from dark
+    light->filtered = sample;
+    light->level = readingToLevel(config, reading);
+    light->started = true;
+    return true;
+  }
+
+  // filtered += (sample - filtered) / 2^filterShift, without going negative
+  if (sample > light->filtered)
+  {
+    light->filtered += (sample - light->filtered) >> config.filterShift;
+  }
+  else
+  {
+    light->filtered -= (light->filtered - sample) >> config.filterShift;
+  }
+
+  uint16_t level = readingToLevel(config, light->filtered >> filterFractionBits);
+  uint16_t change = level > light->level ? level - light->level : light->level - level;
+
+  // the ends of the range are always reached, even within the hysteresis
+  bool limit = (level == config.minLevel || level == config.maxLevel) && level != light->level;
+  if (change <= config.hysteresis && !limit)
+  {
+    return false;
+  }
+
+  light->level = level;
+  return true;
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include "backoff.h"
+
+bool backoffDue(const Backoff &backoff, uint32_t nowMs)
+{
+  // compare the difference to handle the overflow of millis()
+  return backoff.failures == 0 || (int32_t)(nowMs - backoff.nextAttemptAt) >= 0;
+}
+
+void backoffSucceeded(Backoff *backoff)
+{
+  backoff->failures = 0;
+}
+
+BackoffAction backoffFailed(Backoff *backoff, const BackoffConfig &config, uint32_t nowMs, uint32_t randomValue)
+{
+  if (backoff->failures < UINT8_MAX)
+  {
+    backoff->failures++;
+  }
+
+  // double the delay with every failure, without overflowing the shift
+  uint32_t delayMs = config.maxDelayMs;
+  uint8_t doublings = backoff->failures - 1;
+  if (doublings < 32 && config.baseDelayMs <= (config.maxDelayMs >> doublings))
+  {
+    delayMs = config.baseDelayMs << doublings;
+  }
+
+  // subtract a jitter of up to 25% of the delay
+  uint32_t jitterRange = delayMs / 4;
+  if (jitterRange > 0)
+  {
+    delayMs -= randomValue % jitterRange;
+  }
+  backoff->nextAttemptAt = nowMs + delayMs;
+
+  if (backoff->failures >= config.rebootAfter)
+  {
+    return BackoffAction::Reboot;
+  }
+  if (backoff->failures >= config.reconnectAfter)
+  {
+    return BackoffAction::ReconnectWifi;
+  }
+  return BackoffAction::Retry;
+}
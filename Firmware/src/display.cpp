@@ -0,0 +1,577 @@
+#include "display.h"
+#include "display_frame.h"
+#include "display_gamma.h"
+#include "stats.h"
+
+// enable debug messages in display function (slow!!)
+#undef DEBUG_DISPLAY
+
+// PWM: period of the refresh timer, every tick shows one brightness step.
+// Must be longer than shifting out a frame (displayBusFrameUs).
+const uint32_t displayTickUs = displayBusUsesHardwareSpi ? 10 : 40;
+
+// BCM: the time the least significant bit-plane is shown in timer ticks,
+// every following plane is shown twice as long as the previous one
+const uint32_t bcmBaseTicks = (displayBusFrameUs + 1) * displayTimerTicksPerUs;
+
+// the length of a refresh period in timer ticks
+const uint32_t periodTicks = displayEngine == DisplayEngine::Bcm ? bcmBaseTicks * ((1 << bcmBits) - 1) : displayTickUs * displayTimerTicksPerUs * (maxBrightness + 1);
+
+// number of steps of a crossfade between two digits
+const uint8_t fadeSteps = 16;
+
+// number of periods every step of a crossfade is shown
+const uint32_t fadeStepTicks = crossfadeMs * 1000 * displayTimerTicksPerUs / fadeSteps;
+const uint32_t periodsPerFadeStep = fadeStepTicks > periodTicks ? fadeStepTicks / periodTicks : 1;
+
+// the planes of a crossfade are selected with a mask of the bit-planes
+static_assert(bcmBits <= 8, "the crossfade masks hold up to 8 bit-planes");
+
+// the frame that gets shifted out to the display in the order the bytes
+// are shifted out. Double buffered so the ISR never sees a partially
+// written frame: the ISR only reads frames[frontFrame]
+static uint8_t frames[2][numChips];
+static volatile uint8_t frontFrame = 0;
+
+// the frame faded out during a crossfade: the digits of the previous frame
+// with the LEDs and dots of frames[frontFrame]
+static uint8_t fadeFrames[2][numChips];
+
+// BCM: the frame masked for every bit of the brightness. The fraction of a
+// brightness step is dithered by showing the planes of the next step in some
+// periods, so there is a set of planes for every combination of the lower and
+// the higher step of the digits (bit 0 of the set) and the LEDs (bit 1)
+typedef struct
+{
+  uint8_t planes[4][bcmBits][numChips];
+
+  // the planes of the frame faded out during a crossfade
+  uint8_t fadePlanes[4][bcmBits][numChips];
+
+  // the planes showing the digits faded in (bit n for plane n) at every step
+  // of a crossfade, for the lower (0) and the higher (1) step of the digits
+  uint8_t fadeIn[2][fadeSteps];
+
+  // true if all planes are the same and there is no dithering, so a whole
+  // period shows the same outputs once a crossfade is done
+  bool constant;
+
+  // the periods the higher step of the digits (LEDs) is shown in,
+  // bit n is set for the n-th period of the dither cycle
+  uint16_t digitDither;
+  uint16_t ledDither;
+} PlaneSets;
+
+// BCM: Triple buffered, so new planes never wait for the ISR. The planes
+// are written to the set that is neither read by the ISR (activePlanes) nor
+// published (frontPlanes), the ISR switches to a published set at the start
+// of the next BCM period. A set published before the ISR picked up the
+// previous one replaces it
+static PlaneSets planeSets[3];
+static volatile uint8_t frontPlanes = 0;
+static volatile uint8_t activePlanes = 0;
+static volatile bool planesPublished = false;
+
+// BCM: true if a crossfade starts with the published planes, kept until the
+// ISR picked them up so a replacing set does not drop the start
+static volatile bool fadePublished = false;
+
+// current brighnesslevel of the digits
+static volatile uint8_t digitBrightness = maxBrightness;
+
+// current brightnesslevel of the colon
+static volatile uint8_t ledBrightness = maxBrightness;
+
+// the periods the digits (colon) are shown one step brighter,
+// bit n is set for the n-th period of the dither cycle
+static volatile uint16_t digitDither = 0;
+static volatile uint16_t ledDither = 0;
+
+// PWM: the digits faded in at every step of a crossfade in brightness steps,
+// for the lower (0) and the higher (1) step of the digits
+static uint8_t pwmFadeIn[2][fadeSteps];
+
+// PWM: true if a crossfade starts with the frame just swapped in
+static volatile bool pwmFadeStart = false;
+
+// the frame in the shift registers, a frame that is the same is not shifted
+// out again. The latch still copies the registers to the outputs
+static uint8_t shiftedFrame[numChips];
+static bool shiftedValid = false;
+
+/**
+ * @brief shift out a frame unless the shift registers already hold it
+ *
+ * Inlined so the refresh ISR stays in IRAM
+ */
+inline __attribute__((always_inline)) void shiftChanged(const uint8_t *frame)
+{
+  bool changed = !shiftedValid;
+  for (uint8_t chip = 0; chip < numChips; chip++)
+  {
+    changed |= frame[chip] != shiftedFrame[chip];
+    shiftedFrame[chip] = frame[chip];
+  }
+  if (changed)
+  {
+    displayBusShift(frame);
+    statsShift();
+    shiftedValid = true;
+  }
+}
+
+/**
+ * @brief the step of the dither cycle a period is in
+ *
+ * Inlined so the refresh ISR stays in IRAM
+ *
+ * @return true if the period shows the higher brightness step
+ */
+inline __attribute__((always_inline)) bool ditherHigh(uint16_t dither, uint8_t phase)
+{
+  return (dither >> phase) & 0b1;
+}
+
+/**
+ * @brief advance a crossfade at the start of a period
+ *
+ * Inlined so the refresh ISR stays in IRAM
+ *
+ * @param restart true to start the crossfade from the first step
+ */
+inline __attribute__((always_inline)) void fadeAdvance(bool restart, uint8_t *step, uint32_t *periods)
+{
+  if (restart)
+  {
+    *step = 0;
+    *periods = 0;
+  }
+  else if (*step < fadeSteps - 1 && ++*periods >= periodsPerFadeStep)
+  {
+    *step += 1;
+    *periods = 0;
+  }
+}
+
+/**
+ * @brief shift out the actual display data to the shift registers
+ *
+ * Called from the timer1 ISR every displayTickUs, so the PWM keeps running
+ * no matter what loop() is busy with. Latches the frame shifted out during
+ * the last tick and shifts out the next one, masked by the PWM counters.
+ * During a crossfade the on time of the digits starts with the frame faded
+ * out and ends with the frame faded in
+ */
+static void IRAM_ATTR refreshDisplayPwm()
+{
+  // count the number of cycles the digits and dots are on
+  static uint8_t digitPwmCounter = 0;
+  static uint8_t ledPwmCounter = 0;
+
+  // the brightness of the current period, including the dithered step
+  static uint8_t ditherPhase = 0;
+  static uint8_t periodDigitBrightness = maxBrightness;
+  static uint8_t periodLedBrightness = maxBrightness;
+
+  // the frame faded out is shown until the counter reaches the split
+  static uint8_t fadeStep = fadeSteps - 1;
+  static uint32_t fadePeriods = 0;
+  static uint8_t periodFadeSplit = 0;
+
+  uint32_t startCycles = statsFrameStart();
+
+  // show the frame shifted out in the last tick
+  displayBusLatch();
+
+  // the brightness only changes at the start of a period
+  if (digitPwmCounter == 0)
+  {
+    ditherPhase = (ditherPhase + 1) % ditherPhases;
+    bool digitsHigh = ditherHigh(digitDither, ditherPhase);
+    periodDigitBrightness = digitBrightness + digitsHigh;
+    periodLedBrightness = ledBrightness + ditherHigh(ledDither, ditherPhase);
+
+    fadeAdvance(pwmFadeStart, &fadeStep, &fadePeriods);
+    pwmFadeStart = false;
+    periodFadeSplit = periodDigitBrightness - pwmFadeIn[digitsHigh][fadeStep];
+  }
+
+  // mask out the digits if the counter reaches the brightness level
+  uint8_t digitsOff = digitPwmCounter >= periodDigitBrightness ? 0xFF : 0x00;
+  bool fadingOut = digitPwmCounter < periodFadeSplit;
+  // increase the counter
+  digitPwmCounter = (digitPwmCounter + 1) % (maxBrightness + 1);
+
+  // mask out the LEDs if the counter reaches the brightness level
+  uint8_t ledsOff = ledPwmCounter >= periodLedBrightness ? 0xFF : 0x00;
+  // increase the counter
+  ledPwmCounter = (ledPwmCounter + 1) % (maxBrightness + 1);
+
+  // the actual frame to shift out this cycle (with potential masking)
+  const uint8_t *frame = fadingOut ? fadeFrames[frontFrame] : frames[frontFrame];
+  uint8_t maskedFrame[numChips];
+  for (uint8_t chip = 0; chip < numChips; chip++)
+  {
+    maskedFrame[chip] = frame[chip] & ~((digitsFrameMask.bytes[chip] & digitsOff) | (ledsFrameMask.bytes[chip] & ledsOff));
+  }
+
+  shiftChanged(maskedFrame);
+
+  statsFrameEnd(startCycles);
+}
+
+/**
+ * @brief shift out the next bit-plane to the shift registers
+ *
+ * Called from the timer1 ISR. Latches the plane shifted out in the last call,
+ * arms the timer for the weight of that plane and shifts out the next one.
+ * Only the precomputed planes are copied, no masking is done in here.
+ * During a crossfade some planes of the digits show the frame faded out.
+ * If a whole period shows the same outputs, as at full brightness, the ISR
+ * only runs once per period to pick up new planes
+ */
+static void IRAM_ATTR refreshDisplayBcm()
+{
+  // the plane shifted out by the last call
+  static uint8_t pendingPlane = bcmBits - 1;
+
+  // the set of planes of the current period
+  static uint8_t ditherPhase = 0;
+  static uint8_t activeSet = 0;
+
+  // the planes showing the frame faded in during the current period
+  static uint8_t fadeStep = fadeSteps - 1;
+  static uint32_t fadePeriods = 0;
+  static uint8_t fadeInPlanes = 0xFF;
+
+  uint32_t startCycles = statsFrameStart();
+
+  // show the pending plane as long as its weight
+  displayBusLatch();
+  displayTimerArm(bcmBaseTicks << pendingPlane);
+
+  pendingPlane = (pendingPlane + 1) % bcmBits;
+
+  // only switch to new planes at the start of a period, otherwise
+  // the brightness of a single period would be a mix of both
+  if (pendingPlane == 0)
+  {
+    bool swapped = planesPublished;
+    bool fadeStart = swapped && fadePublished;
+    if (swapped)
+    {
+      activePlanes = frontPlanes;
+      planesPublished = false;
+      fadePublished = false;
+    }
+    const PlaneSets *sets = &planeSets[activePlanes];
+
+    ditherPhase = (ditherPhase + 1) % ditherPhases;
+    activeSet = ditherHigh(sets->digitDither, ditherPhase) |
+                ditherHigh(sets->ledDither, ditherPhase) << 1;
+
+    fadeAdvance(fadeStart, &fadeStep, &fadePeriods);
+    fadeInPlanes = sets->fadeIn[activeSet & 0b1][fadeStep];
+
+    // the plane just latched is the same as all planes of the period, show
+    // it for a whole period. After a swap it is still one of the old planes
+    if (!swapped && sets->constant && fadeStep == fadeSteps - 1)
+    {
+      displayTimerArm(periodTicks);
+      pendingPlane = bcmBits - 1;
+      statsFrameEnd(startCycles);
+      return;
+    }
+  }
+
+  const PlaneSets *sets = &planeSets[activePlanes];
+  if ((fadeInPlanes >> pendingPlane) & 0b1)
+  {
+    shiftChanged(sets->planes[activeSet][pendingPlane]);
+  }
+  else
+  {
+    shiftChanged(sets->fadePlanes[activeSet][pendingPlane]);
+  }
+
+  statsFrameEnd(startCycles);
+}
+
+/**
+ * @brief the share of the digits faded in at a step of a crossfade
+ *
+ * @param brightness the brightness of the digits
+ * @return the planes to show the digits faded in, bit n for plane n. The
+ * other planes of the brightness show the digits faded out, so the old and
+ * the new digit of a tube are never lit at the same time
+ */
+static uint8_t bcmFadeIn(uint16_t brightness, uint8_t step)
+{
+  uint16_t target = brightness * step / (fadeSteps - 1);
+
+  // the largest sum of the planes of the brightness not above the target
+  uint8_t planes = 0;
+  uint16_t sum = 0;
+  for (int8_t plane = bcmBits - 1; plane >= 0; plane--)
+  {
+    uint16_t weight = 1 << plane;
+    if ((brightness & weight) && sum + weight <= target)
+    {
+      planes |= weight;
+      sum += weight;
+    }
+  }
+  return planes;
+}
+
+/**
+ * @brief mask a frame for a bit-plane of the BCM
+ */
+static void maskPlane(const uint8_t *frame, uint8_t *plane, uint8_t digitsOff, uint8_t ledsOff)
+{
+  for (uint8_t chip = 0; chip < numChips; chip++)
+  {
+    plane[chip] = frame[chip] & ~((digitsFrameMask.bytes[chip] & digitsOff) | (ledsFrameMask.bytes[chip] & ledsOff));
+  }
+}
+
+/**
+ * @brief precompute the masked frame for every bit-plane of the BCM
+ *
+ * Writes the planes neither read by the ISR nor published and publishes
+ * them, never waits for the ISR.
+ * A plane shows the digits (LEDs) if the corresponding bit of their
+ * brightness is set, for the lower and the higher step of the dithering
+ *
+ * @param fadeStart true to start a crossfade from the previous digits
+ */
+static void updatePlanes(bool fadeStart)
+{
+  // the ISR only switches to the published set, so once the published set is
+  // known the active one is either the same or stays as it is
+  uint8_t published = frontPlanes;
+  uint8_t active = activePlanes;
+  uint8_t backPlanes = 0;
+  while (backPlanes == published || backPlanes == active)
+  {
+    backPlanes++;
+  }
+
+  const uint8_t *frame = frames[frontFrame];
+  const uint8_t *fadeFrame = fadeFrames[frontFrame];
+  PlaneSets *sets = &planeSets[backPlanes];
+  for (uint8_t set = 0; set < 4; set++)
+  {
+    // the higher step is only shown if there is a fraction to dither,
+    // so it never exceeds maxBrightness when it is used
+    if (((set & 0b01) && !digitDither) || ((set & 0b10) && !ledDither))
+    {
+      continue;
+    }
+    uint16_t digits = digitBrightness + (set & 0b1);
+    uint16_t leds = ledBrightness + ((set >> 1) & 0b1);
+    for (uint8_t plane = 0; plane < bcmBits; plane++)
+    {
+      uint8_t digitsOff = (digits >> plane) & 0b1 ? 0x00 : 0xFF;
+      uint8_t ledsOff = (leds >> plane) & 0b1 ? 0x00 : 0xFF;
+      maskPlane(frame, sets->planes[set][plane], digitsOff, ledsOff);
+      maskPlane(fadeFrame, sets->fadePlanes[set][plane], digitsOff, ledsOff);
+    }
+  }
+
+  for (uint8_t step = 0; step < fadeSteps; step++)
+  {
+    sets->fadeIn[0][step] = bcmFadeIn(digitBrightness, step);
+    sets->fadeIn[1][step] = bcmFadeIn(digitBrightness + 1, step);
+  }
+  sets->constant = !digitDither && !ledDither;
+  for (uint8_t plane = 1; plane < bcmBits; plane++)
+  {
+    sets->constant &= memcmp(sets->planes[0][plane], sets->planes[0][0], numChips) == 0;
+  }
+  sets->digitDither = digitDither;
+  sets->ledDither = ledDither;
+
+  // the ISR must not pick up the set without its fade flag
+  noInterrupts();
+  frontPlanes = backPlanes;
+  fadePublished = fadePublished || fadeStart;
+  planesPublished = true;
+  interrupts();
+}
+
+void displayBegin()
+{
+  displayBusBegin();
+  if (displayEngine == DisplayEngine::Bcm)
+  {
+    updatePlanes(false);
+    displayTimerBegin(refreshDisplayBcm, false);
+    displayTimerArm(bcmBaseTicks);
+  }
+  else
+  {
+    displayTimerBegin(refreshDisplayPwm, true);
+    displayTimerArm(displayTickUs * displayTimerTicksPerUs);
+  }
+}
+
+void setDisplayDigits(const uint8_t *digits, uint8_t dots, bool colon, bool crossfade)
+{
+  // write the frame into the buffer not read by the ISR
+  uint8_t backFrame = frontFrame ^ 1;
+  uint8_t *frame = frames[backFrame];
+  memset(frame, 0x00, numChips);
+
+  // set the digits, a tube stays dark if there is no cathode for the value
+  for (uint8_t digit = 0; digit < numDigits; digit++)
+  {
+    if (digits[digit] < 10)
+    {
+      setFrameBit(frame, frameTable.digits[digit][digits[digit]]);
+    }
+  }
+
+  // set the outputs for the passed dot-state
+  for (uint8_t dot = 0; dot < numDigits; dot++)
+  {
+    if ((dots >> dot) & 0b1)
+    {
+      setFrameBit(frame, frameTable.dots[dot]);
+    }
+  }
+
+  if (colon)
+  {
+    setFrameBit(frame, frameTable.leds[0]);
+    setFrameBit(frame, frameTable.leds[1]);
+  }
+
+  // fade out the digits shown until now, even if the last crossfade is not
+  // done yet. The LEDs and dots are switched right away. Without a
+  // crossfade both frames are the same
+  const uint8_t *shownFrame = crossfade ? frames[frontFrame] : frame;
+  uint8_t *fadeFrame = fadeFrames[backFrame];
+  for (uint8_t chip = 0; chip < numChips; chip++)
+  {
+    fadeFrame[chip] = (shownFrame[chip] & digitsFrameMask.bytes[chip]) | (frame[chip] & ~digitsFrameMask.bytes[chip]);
+  }
+
+  // swap the buffers
+  frontFrame = backFrame;
+
+  if (displayEngine == DisplayEngine::Bcm)
+  {
+    updatePlanes(true);
+  }
+  else
+  {
+    pwmFadeStart = true;
+  }
+
+#ifdef DEBUG_DISPLAY
+  for (uint8_t chip = 0; chip < numChips; chip++)
+  {
+    Serial.print("Chip ");
+    Serial.print(numChips - 1 - chip);
+    Serial.print(" set to state ");
+    Serial.println(String(frames[backFrame][chip], BIN));
+  }
+#endif
+}
+
+void timeToDigits(const tmElements_t &time, uint8_t *digits)
+{
+  const uint8_t values[3] = {time.Hour, time.Minute, time.Second};
+  for (uint8_t digit = 0; digit < numDigits; digit++)
+  {
+    uint8_t value = values[digit / 2];
+    digits[digit] = digit % 2 ? value % 10 : value / 10;
+  }
+}
+
+void setDisplay(tmElements_t time, uint8_t dots)
+{
+  uint8_t digits[numDigits];
+  timeToDigits(time, digits);
+
+#ifdef DEBUG_DISPLAY
+  Serial.print("setting display to ");
+  Serial.print(time.Hour);
+  Serial.print(time.Second % 2 ? ":" : " ");
+  Serial.println(String(time.Minute));
+#endif
+
+  // blink the LED seperator every other second
+  setDisplayDigits(digits, dots, time.Second % 2, true);
+}
+
+/**
+ * @brief spread the fraction of a brightness step evenly over the periods
+ * of the dither cycle (first order sigma-delta)
+ *
+ * @param fraction the fraction in 1/ditherPhases steps
+ * @return the periods to show the higher step in, bit n for the n-th period
+ */
+static uint16_t ditherPattern(uint8_t fraction)
+{
+  uint16_t pattern = 0;
+  uint8_t error = 0;
+  for (uint8_t phase = 0; phase < ditherPhases; phase++)
+  {
+    error += fraction;
+    if (error >= ditherPhases)
+    {
+      error -= ditherPhases;
+      pattern |= 1 << phase;
+    }
+  }
+  return pattern;
+}
+
+/**
+ * @brief set the duty cycle of the digits and the colon LEDs
+ *
+ * @param digits duty cycle of the digits in 1/ditherPhases brightness steps
+ * @param leds duty cycle of the colon in 1/ditherPhases brightness steps
+ */
+static void setDisplayDuty(uint16_t digits, uint16_t leds)
+{
+  digits = min(digits, maxDuty);
+  leds = min(leds, maxDuty);
+  uint16_t digitsPattern = ditherPattern(digits & (ditherPhases - 1));
+  uint16_t ledsPattern = ditherPattern(leds & (ditherPhases - 1));
+
+  uint8_t brightness = digits >> ditherBits;
+  uint8_t fadeIn[2][fadeSteps];
+  for (uint8_t step = 0; step < fadeSteps; step++)
+  {
+    fadeIn[0][step] = brightness * step / (fadeSteps - 1);
+    fadeIn[1][step] = (brightness + 1) * step / (fadeSteps - 1);
+  }
+
+  // the PWM ISR reads the brightness and the dithering at the start of
+  // every period, they must not be mixed up
+  noInterrupts();
+  digitBrightness = brightness;
+  digitDither = digitsPattern;
+  memcpy(pwmFadeIn, fadeIn, sizeof(pwmFadeIn));
+  ledBrightness = leds >> ditherBits;
+  ledDither = ledsPattern;
+  interrupts();
+
+  if (displayEngine == DisplayEngine::Bcm)
+  {
+    updatePlanes(false);
+  }
+}
+
+void setDisplayBrightness(uint8_t digits, uint8_t leds)
+{
+  setDisplayDuty(min(digits, maxBrightness) << ditherBits, min(leds, maxBrightness) << ditherBits);
+}
+
+void setDisplayLevel(uint16_t digits, uint16_t leds)
+{
+  setDisplayDuty(levelToDuty(digits), levelToDuty(leds));
+}
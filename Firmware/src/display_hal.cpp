@@ -0,0 +1,112 @@
+#include "display_hal.h"
+
+#include <SPI.h>
+
+// the bit of the latch, clock and data pins in the GPIO registers.
+// GPIO16 is not part of the GPOS/GPOC registers
+static_assert(latchPin < 16 && clockPin < 16 && dataPin < 16, "display pins must be GPIO0..GPIO15");
+const uint32_t latchPinMask = 1 << latchPin;
+const uint32_t clockPinMask = 1 << clockPin;
+const uint32_t dataPinMask = 1 << dataPin;
+
+void displayBusBegin()
+{
+  pinMode(latchPin, OUTPUT);
+
+  if (displayBusUsesHardwareSpi)
+  {
+    // the TPIC6B595 samples the data on the rising edge of the clock
+    SPI.begin();
+    SPI.setFrequency(displaySpiFrequency);
+    SPI.setBitOrder(MSBFIRST);
+    SPI.setDataMode(SPI_MODE0);
+
+    // the whole frame is transferred with a single command
+    // from the data buffer of the HSPI
+    const uint32_t bitsMask = ~((SPIMMOSI << SPILMOSI) | (SPIMMISO << SPILMISO));
+    const uint32_t bits = numChips * 8 - 1;
+    SPI1U1 = (SPI1U1 & bitsMask) | (bits << SPILMOSI) | (bits << SPILMISO);
+  }
+  else
+  {
+    pinMode(clockPin, OUTPUT);
+    pinMode(dataPin, OUTPUT);
+  }
+}
+
+void IRAM_ATTR displayBusLatch()
+{
+  // latching a half shifted frame would show garbage. The planes are timed
+  // to outlast the transfer (displayBusFrameUs), this only spins if they don't
+  if (displayBusUsesHardwareSpi)
+  {
+    while (SPI1CMD & SPIBUSY)
+    {
+    }
+  }
+
+  // the TPIC6B595 latches the shift register into the outputs
+  // on the rising edge of the latch pin
+  GPOC = latchPinMask;
+  GPOS = latchPinMask;
+}
+
+void IRAM_ATTR displayBusShift(const uint8_t *frame)
+{
+  if (displayBusUsesHardwareSpi)
+  {
+    // the last transfer is long done when the next frame is due,
+    // this only guards against overwriting the buffer while it is sent
+    while (SPI1CMD & SPIBUSY)
+    {
+    }
+
+    // the HSPI sends the data buffer in memory order (LSByte of W0 first)
+    volatile uint32_t *spiBuffer = &SPI1W0;
+    for (uint8_t chip = 0; chip < numChips; chip += 4)
+    {
+      uint32_t word = 0;
+      for (uint8_t byte = 0; byte < 4 && chip + byte < numChips; byte++)
+      {
+        word |= (uint32_t)frame[chip + byte] << (byte * 8);
+      }
+      *spiBuffer++ = word;
+    }
+
+    // start the transfer, it finishes in the background
+    SPI1CMD |= SPIBUSY;
+  }
+  else
+  {
+    // shiftOut() is not placed in IRAM, so it can't be used from the ISR.
+    // Writing the set/clear registers directly instead of going through
+    // digitalWrite() brings a frame down from ~150µs to a few µs
+    for (uint8_t chip = 0; chip < numChips; chip++)
+    {
+      for (int8_t bit = 7; bit >= 0; bit--)
+      {
+        if ((frame[chip] >> bit) & 0b1)
+        {
+          GPOS = dataPinMask;
+        }
+        else
+        {
+          GPOC = dataPinMask;
+        }
+        GPOS = clockPinMask;
+        GPOC = clockPinMask;
+      }
+    }
+  }
+}
+
+void displayTimerBegin(void (*isr)(), bool periodic)
+{
+  timer1_attachInterrupt(isr);
+  timer1_enable(TIM_DIV16, TIM_EDGE, periodic ? TIM_LOOP : TIM_SINGLE);
+}
+
+void IRAM_ATTR displayTimerArm(uint32_t ticks)
+{
+  timer1_write(ticks);
+}
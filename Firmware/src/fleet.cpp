@@ -0,0 +1,215 @@
+#include "fleet.h"
+#include "trace.h"
+
+#include <ESP8266WiFi.h>
+#include <ESP8266mDNS.h>
+#include <WiFiUdp.h>
+
+// disable debug messages to the serial port
+#undef DEBUG
+
+// the multicast group and port of the packets of the leader
+// (in the administratively scoped range, never routed beyond the LAN)
+const IPAddress fleetGroup(239, 255, 43, 21);
+const uint16_t fleetPort = 4321;
+
+// the service the leader announces over mDNS (_nixie-time._udp)
+const char *fleetServiceName = "nixie-time";
+
+// identifies the packets of the leader ("NXTM")
+const uint32_t fleetMagic = 0x4D54584E;
+const uint8_t fleetVersion = 1;
+
+// the leader multicasts the time every 16 seconds
+const uint32_t announceIntervalS = 16;
+
+// a follower takes over after the leader missed 4 packets. Spread by up to
+// 16s by the chip ID, so the followers don't all start to sync at once
+const uint32_t leaderTimeoutMs = 4 * announceIntervalS * 1000;
+const uint32_t leaderTimeoutSpreadMs = 16 * 1000;
+
+// the number of packets handled per call, the rest is handled in the next one
+const uint8_t packetsPerService = 4;
+
+// the packet multicast by the leader, in the byte order of the ESP8266
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;
+  uint8_t version;
+  uint8_t dstInEffect;
+  uint32_t leaderId;
+  uint32_t utc;
+  int32_t offset;
+  uint32_t validUntil;
+} FleetPacket;
+
+static WiFiUDP udp;
+static FleetRole role = FleetRole::Candidate;
+
+// the chip ID of this clock, the clock with the lowest ID leads
+static uint32_t chipId;
+
+// the time this clock waits for the leader, including the spread
+static uint32_t timeoutMs;
+
+// the chip ID of the followed leader, unknownLeader if it was only
+// found over mDNS and no packet was received yet
+const uint32_t unknownLeader = UINT32_MAX;
+static uint32_t leaderId = unknownLeader;
+
+// millis() of the last packet of the leader (or the role change)
+static uint32_t leaderHeardAt;
+
+// the time of the last packet multicast as leader
+static time_t announcedAt = 0;
+
+// the mDNS service announced as leader
+static MDNSResponder::hMDNSService announcedService = nullptr;
+
+/**
+ * @brief switch the role and announce or withdraw the mDNS service
+ */
+static void switchRole(FleetRole newRole)
+{
+#ifdef DEBUG
+  Serial.print("Fleet role: ");
+  Serial.println(newRole == FleetRole::Leader ? "leader" : (newRole == FleetRole::Follower ? "follower" : "candidate"));
+#endif
+
+  if (newRole == FleetRole::Leader)
+  {
+    // the instance is named after the host
+    announcedService = MDNS.addService(nullptr, fleetServiceName, "udp", fleetPort);
+    announcedAt = 0;
+  }
+  else if (role == FleetRole::Leader && announcedService != nullptr)
+  {
+    MDNS.removeService(announcedService);
+    announcedService = nullptr;
+  }
+
+  trace(TraceEvent::FleetRole, (uint16_t)newRole);
+  role = newRole;
+  leaderHeardAt = millis();
+}
+
+void fleetBegin()
+{
+  chipId = ESP.getChipId();
+  timeoutMs = leaderTimeoutMs + chipId % leaderTimeoutSpreadMs;
+  udp.beginMulticast(WiFi.localIP(), fleetGroup, fleetPort);
+
+  // wait for the packets of a leader instead of syncing on its own
+  if (MDNS.queryService(fleetServiceName, "udp") > 0)
+  {
+    leaderId = unknownLeader;
+    switchRole(FleetRole::Follower);
+  }
+  else
+  {
+    switchRole(FleetRole::Candidate);
+  }
+}
+
+/**
+ * @brief check if the packet of a leader is followed
+ *
+ * @return true if the clock follows the sender of the packet
+ */
+static bool handlePacket(const FleetPacket &packet)
+{
+  switch (role)
+  {
+  case FleetRole::Leader:
+    // two leaders after a failover, the lower chip ID keeps the lead
+    if (packet.leaderId > chipId)
+    {
+      return false;
+    }
+    break;
+
+  case FleetRole::Follower:
+    // another leader is only followed if it wins against the current one
+    if (leaderId != unknownLeader && packet.leaderId > leaderId)
+    {
+      return false;
+    }
+    break;
+
+  case FleetRole::Candidate:
+    break;
+  }
+
+  if (role != FleetRole::Follower)
+  {
+    switchRole(FleetRole::Follower);
+  }
+  leaderId = packet.leaderId;
+  leaderHeardAt = millis();
+  return true;
+}
+
+bool fleetService(bool synced, FleetTime *out)
+{
+  bool received = false;
+  for (uint8_t count = 0; count < packetsPerService && udp.parsePacket() > 0; count++)
+  {
+    FleetPacket packet;
+    if (udp.available() != sizeof(packet) ||
+        udp.read((uint8_t *)&packet, sizeof(packet)) != sizeof(packet) ||
+        packet.magic != fleetMagic || packet.version != fleetVersion || packet.leaderId == chipId)
+    {
+      continue;
+    }
+
+    if (handlePacket(packet))
+    {
+      out->utc = packet.utc;
+      out->tzInfo.dstInEffect = packet.dstInEffect;
+      out->tzInfo.offset = packet.offset;
+      out->tzInfo.validUntil = packet.validUntil;
+      received = true;
+    }
+  }
+
+  uint32_t silentMs = millis() - leaderHeardAt;
+  if (role == FleetRole::Follower && silentMs > timeoutMs)
+  {
+    // the leader is gone, sync on its own until a new one is heard
+    leaderId = unknownLeader;
+    switchRole(FleetRole::Candidate);
+  }
+  else if (role == FleetRole::Candidate && synced && silentMs > timeoutMs)
+  {
+    switchRole(FleetRole::Leader);
+  }
+
+  return received;
+}
+
+void fleetAnnounce(time_t utc, const TzInfo &tzInfo)
+{
+  if (role != FleetRole::Leader || (announcedAt != 0 && utc - announcedAt < (time_t)announceIntervalS))
+  {
+    return;
+  }
+  announcedAt = utc;
+
+  FleetPacket packet;
+  packet.magic = fleetMagic;
+  packet.version = fleetVersion;
+  packet.dstInEffect = tzInfo.dstInEffect;
+  packet.leaderId = chipId;
+  packet.utc = utc;
+  packet.offset = tzInfo.offset;
+  packet.validUntil = tzInfo.validUntil;
+
+  udp.beginPacketMulticast(fleetGroup, fleetPort, WiFi.localIP());
+  udp.write((const uint8_t *)&packet, sizeof(packet));
+  udp.endPacket();
+}
+
+FleetRole fleetRole()
+{
+  return role;
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#include "json_format.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+size_t appendFormat(char *buffer, size_t size, size_t length, const char *format, ...)
+{
+  size_t offset = min(length, size);
+  va_list args;
+  va_start(args, format);
+  int appended = vsnprintf(buffer + offset, size - offset, format, args);
+  va_end(args);
+  return length + max(appended, 0);
+}
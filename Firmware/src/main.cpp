@@ -1,460 +1,1387 @@
 #include <Arduino.h>
 
 #include <ESP8266WiFi.h>
-#include <ESP8266HTTPClient.h>
 #include <ESP8266mDNS.h>
 #include <DNSServer.h>
 #include <ESP8266WebServer.h>
 
 #include <WiFiManager.h>
-#include <WiFiClient.h>
+#include <ArduinoOTA.h>
 
 #include <NtpClientLib.h>
 #include <TimeLib.h>
 
 #include <Ticker.h>
 
-#define VARIANT 12
-#include "config.h"
 #include "pins.h"
+#include "display.h"
+#include "tzinfo.h"
+#include "timezone_db.h"
+#include "tz_rule.h"
+#include "persistence.h"
+#include "backoff.h"
+#include "stats.h"
+#include "slot_machine.h"
+#include "ambient_light.h"
+#include "fleet.h"
+#include "second_phase.h"
+#include "scheduler.h"
+#include "trace.h"
+
+// OTA updates are only accepted with an OTA_PASSWORD in include/config.h,
+// an open update port would let anybody on the LAN flash the clock
+#if __has_include("config.h")
+#include "config.h"
+#endif
 
-// enable uint64 support for UNIX timestamps
-// and avoid the Y2038 problem
-#define ARDUINOJSON_USE_LONG_LONG 1
-#include <ArduinoJson.h>
+#if defined(OTA_UPLOAD) && !defined(OTA_PASSWORD)
+#error "uploading over the air needs an OTA_PASSWORD in include/config.h"
+#endif
 
 // disable debug messages to the serial port
 #undef DEBUG
-// enable debug messages in display function (very slow!!) not working really well with PWM
-#undef DEBUG_DISPLAY
 
-typedef struct
-{
-  /**
-   * @brief dstInEffect a boolean indicating whether DST is currently active
-   */
-  bool dstInEffect;
+// query the timezone info from the timezonedb.com API instead of computing it
+// on the device from the rule of the config (needs the TZDB_API_KEY in include/config.h)
+#undef USE_TIMEZONEDB
 
-  /**
-   * @brief the current offset to GMT
-   */
-  int32_t offset;
+// follow the ambient light measured by an LDR on A0 instead of dimming
+// the display by the time of the day (needs the LDR voltage divider)
+#undef USE_AMBIENT_LIGHT
 
-  /**
-   * @brief the currently requested data is valid until this unix timestamp (UTC)
-   */
-  time_t validUntil;
-} TzInfo;
+// share the time with the other clocks on the LAN, only one of them syncs
+// with NTP (and the timezonedb.com API). Needs the radio on (no PowerMode::RadioOff)
+#undef USE_FLEET
 
 // The WiFiManager Object handles the auto-connect feature
 WiFiManager wifiManager;
-WiFiClient client;
 
-// Actual loop rate is measuread at ~5.6kHz (177µs) with a 100µs space
-// when setting a new value to the display (DEBUG set, DEBUG_DISPLAY cleared).
-// With 10 bigthness levels, the PWM frequency is 1ms which corresponds to a
-// 500Hz refresh rate which is absolutley invisible
-const uint8_t maxBrightness = 50;
+// the config used until one was saved over the web API. Half the perceived
+// brightness at nighttime (~18% duty cycle) from 21:00 to 6:00. The rules of
+// the zone as POSIX TZ string used to compute the timezone info on the device
+// (see the last line of the zone file in /usr/share/zoneinfo)
+const ClockConfig defaultConfig = {"Europe/Berlin", "CET-1CEST,M3.5.0,M10.5.0/3", 21, 6,
+                                   maxDisplayLevel, maxDisplayLevel / 2, true};
+
+// sample the LDR 4 times per second, the moving average follows within
+// a few seconds. Dim to half the default night level in the dark, steps of 1.5% of the
+// range are ignored. analogRead() takes ~100µs and disturbs the WiFi if it
+// is called too often
+const AmbientLightConfig ambientLightConfig = {250, 40, 800, maxDisplayLevel / 4, maxDisplayLevel, 64, 3};
+
+// how long all cathodes are exercised against cathode poisoning,
+// at every full hour of the low-brightness period
+const uint32_t antiPoisoningMs = 30000;
+
+// the maximum time per loop() iteration spent on querying the timezone info
+const uint32_t tzFetchSliceUs = 2000;
+
+// when to run the self-test cycling all digits at boot
+enum class SelfTestMode
+{
+  Always,
+  // only after a power-on or a reset by the reset pin, not after
+  // a soft reset, WDT reset or exception
+  ColdBoot,
+  Never,
+};
+const SelfTestMode selfTestMode = SelfTestMode::ColdBoot;
+
+// duration of a single step of the self-test
+const uint32_t selfTestStepMs = 300;
+
+// how the WiFi saves power between the NTP syncs. The current spikes of the
+// radio also show up as flicker on the HV supply
+enum class PowerMode
+{
+  // the radio is always on
+  AlwaysOn,
+  // the radio sleeps between the beacons of the access point, the clock
+  // stays connected and the web API reachable with some latency
+  ModemSleep,
+  // the radio is off between the syncs, the web API and mDNS are
+  // only reachable while it is awake
+  RadioOff,
+};
+const PowerMode powerMode = PowerMode::ModemSleep;
+
+// ModemSleep: only wake for every 3rd DTIM beacon of the access point
+// (~300ms with the usual beacon interval and DTIM period)
+const uint8_t modemSleepListenInterval = 3;
+
+// RadioOff: the time the radio is off between two syncs. The crystal drifts
+// less than 20ppm, i.e. less than 20ms until the next sync
+const uint32_t radioOffMs = 15 * 60 * 1000;
+
+// RadioOff: the radio stays awake at least this long for the web API,
+// and at most this long if the sync does not succeed
+const uint32_t radioMinAwakeMs = 30 * 1000;
+const uint32_t radioMaxAwakeMs = 2 * 60 * 1000;
+
+// the PWM runs its ISR every brightness step and profits from the faster CPU,
+// the BCM only runs it a few times per period and saves power at 80MHz
+const uint8_t cpuFreqMHz = displayEngine == DisplayEngine::Pwm ? 160 : 80;
+
+#ifdef USE_FLEET
+static_assert(powerMode != PowerMode::RadioOff, "the followers of the fleet need the radio to receive the time");
+#endif
+
+// the NTP server synced with, and asked for the start of the second
+const char *ntpServer = "pool.ntp.org";
+
+// measure the start of the second every ~4min, the crystal drifts less than
+// 5ms in between. Retry every 16s until the first measurement succeeded
+const uint32_t phaseProbeIntervalMs = 256 * 1000;
+const uint32_t phaseRetryMs = 16 * 1000;
+
+// a measurement older than 1h (~70ms of drift) is no longer used, the
+// second flips when TimeLib assumes it until the next one succeeded
+const uint32_t phaseMaxAgeMs = 60 * 60 * 1000;
+
+// retry a failed timezone info query after 5s, doubling the delay up to
+// 30min. Reconnect the WiFi after 4 and reboot after 8 failures in a row
+const BackoffConfig tzResyncConfig = {5000, 30 * 60 * 1000, 4, 8};
 
-// 20% duty cycle at nighttime
-const uint8_t lowBrightness = (maxBrightness / 10) * 2;
+// the port of the HTTP server
+const uint16_t httpPort = 80;
 
-// begin of the low-brightness period
-const uint8_t beginLowBrightnessHour = 21;
+// the host name of the clock for mDNS and the OTA updates
+const char *hostName = "nixie";
 
-// end of the low-brightness period
-const uint8_t endLowBrightnessHour = 6;
+// the time per loop() iteration the HTTP server may take. A request that took
+// longer is paid back by pausing the server for as long as it took, so it never
+// gets more than half of the loop() under load
+const uint32_t httpSliceUs = 5000;
 
-const String timezoneName = "Europe/Berlin";
-// API Key is defined in include/config.h
-// which is ignored by git to keep the key private
-const String timezoneDbUrl = String("http://api.timezonedb.com/v2.1/get-time-zone?format=json&key=") + TZDB_API_KEY + String("&by=zone&zone=") + timezoneName;
-// a normal response from the timezonedb has 13 objects
-// required size calculated with https://arduinojson.org/v5/assistant/
-const int responseCapacity = JSON_OBJECT_SIZE(13) + 260;
+// a loop() iteration starting this long after the last one is traced
+const uint32_t loopStallTraceUs = 250000;
+
+// the time after which a pass of the loop() starts no further task,
+// the rest is run in the next pass
+const uint32_t loopBudgetUs = 10000;
+
+// a config changed over the web API is saved once it was not changed for this
+// long, so a series of changes only writes the flash once
+const uint32_t configSaveDelayMs = 5000;
+
+// the current config, restored from flash at boot
+ClockConfig config;
+
+// true if the config was changed but not yet saved
+bool configDirty = false;
+
+// millis() of the last change to the config
+uint32_t configChangedAt;
+
+// the parsed timezone rule of the config
+TzRule tzRule;
+
+// RadioOff: true while the radio is awake and NTP is running
+bool radioOn = true;
+bool ntpRunning = false;
+
+// RadioOff: millis() when the radio was woken or turned off
+uint32_t radioSwitchedAt;
+
+// RadioOff: the last NTP sync before the radio was woken
+time_t syncBeforeWake = 0;
+
+// the last measured start of a UTC second, by SNTP or the leader of the fleet
+SecondPhase secondPhase = {false, 0, 0, 0};
+
+// the ms the display was updated after the measured start of the second,
+// -1 if the start of the second is not known
+int32_t displayLagMs = -1;
+
+// the scheduler of the retries of failed timezone info queries
+Backoff tzResync;
+
+// the filtered ambient light and the brightness level derived from it
+AmbientLight ambientLight;
 
 // The object to store the current timezone info queried at the start of
 // the sketch or at runtime if the object was no longer valid
 TzInfo tzInfo;
 
+// serves the stats, status and configuration of the clock
+ESP8266WebServer server(httpPort);
+
 // A ticker used to display an animation on the display while connecting
 // to the WiFi
 Ticker connectingTicker;
 
-// the serial stream that gets shifted out to the display
-uint64_t displaySerialStream;
+// A ticker advancing the self-test in the background
+Ticker selfTestTicker;
+
+// true while the self-test owns the display
+volatile bool selfTestRunning = false;
 
-// current brighnesslevel of the digits
-uint8_t digitBrightness = maxBrightness;
+// the progress shown during an OTA update, only changes are shown
+uint8_t shownOtaPercent;
 
-// current brightnesslevel of the colon
-uint8_t ledBrightness = maxBrightness;
+// true while the time restored after a soft reset is shown instead of
+// the passcode animation while connecting to the WiFi
+bool showRestoredTime = false;
+
+// the random numeric 4-digit passcode of the config portal. The portal is
+// served from the loop(), the passcode is shown for as long as it is open
+char apPasscode[5];
+
+// false while the config portal is open, true once the WiFi is connected
+// and the network services are started
+bool networkUp = false;
 
 /**
- * @brief Get Timezone Info from the timezonedb.com API
- *
- * @param[out] out the struc containing the new timezone data
- * @return true if the request was successful and the out params are written
- * @return false otherwise
+ * @brief set the offset of the current timezone info to the NTPClient
  */
-bool getTzInfo(TzInfo *out)
+void applyTzInfo()
 {
-  if (WiFi.status() != WL_CONNECTED)
-  {
-    return false;
-  }
+  // keep it for a fast startup after the next reset
+  saveTzInfo(tzInfo);
 
-  HTTPClient http;
-  http.begin(client, timezoneDbUrl);
-
-  // check the return code
-  if (http.GET() != HTTP_CODE_OK)
+  // offset is specified in seconds, convert it to
+  // whole hours and seperate minutes for the NTPClient
+  if (!NTP.setTimeZone(tzInfo.offset / SECS_PER_HOUR, (tzInfo.offset % SECS_PER_HOUR) / SECS_PER_MIN))
   {
 #ifdef DEBUG
-    Serial.print("GET failed for URL ");
-    Serial.println(timezoneDbUrl);
-    Serial.println(http.getString());
+    Serial.println("Failed to set timezone!");
 #endif
-
-    http.end();
-    return false;
   }
   else
   {
-    String response = http.getString();
-    http.end();
 #ifdef DEBUG
-    Serial.println("GET to timezonedb.com API succeeded. Reponse:");
-    Serial.println(response);
+    Serial.print("New Timezone offset: ");
+    Serial.print(NTP.getTimeZone());
+    Serial.print(" hours and ");
+    Serial.print(NTP.getTimeZoneMinutes());
+    Serial.println(" minutes.");
 #endif
-    // parse the request response payload
-    StaticJsonDocument<responseCapacity> document;
-    deserializeJson(document, response);
+  }
+}
 
+/**
+ * @brief handle the result of a finished timezone info query
+ *
+ * if the request to the timezonedb.com API fails, the clock keeps
+ * running on the last good offset and the query is retried with an
+ * exponential backoff. If it keeps failing the WiFi is reconnected and
+ * finally the ESP is rebooted. This gives it the chance to start in AP
+ * mode if the credentials are no longer valid
+ *
+ */
+void handleTzFetchResult(TzFetchResult result)
+{
+  if (result == TzFetchResult::Failed)
+  {
+    BackoffAction action = backoffFailed(&tzResync, tzResyncConfig, millis(), RANDOM_REG32);
+    trace(TraceEvent::TzFetchFailed, tzResync.failures);
 #ifdef DEBUG
-    Serial.println("Parsed JSON:");
-    serializeJson(document, Serial);
-    Serial.println();
+    Serial.print("Failed to get TZ Info! ");
+    Serial.print(tzResync.failures);
+    Serial.println(" failures in a row");
 #endif
-    // dst is a string, not a boolean
-    // convert it to a boolean by string comparison
-    out->dstInEffect = document["dst"].as<String>().equals("1");
 
-    // gmtOffset is specified in seconds
-    out->offset = document["gmtOffset"].as<int32_t>();
+    switch (action)
+    {
+    case BackoffAction::Retry:
+      break;
 
-    // get the validUntil as time_t(uint64_t) as this is the
-    // (potential) size of a UNIX timestamp
-    out->validUntil = document["zoneEnd"].as<time_t>();
+    case BackoffAction::ReconnectWifi:
+#ifdef DEBUG
+      Serial.println("Reconnecting the WiFi");
+#endif
+      trace(TraceEvent::WifiReconnect);
+      WiFi.reconnect();
+      break;
 
-    return true;
+    case BackoffAction::Reboot:
+#ifdef DEBUG
+      Serial.println("Rebooting");
+#endif
+      // Best bet is to do a clean reboot so we can reconnect
+      // if we lost the WiFi connection or start the AP
+      // if the credentials are no longer valid
+      trace(TraceEvent::Reboot);
+      ESP.restart();
+      break;
+    }
+  }
+  else
+  {
+    backoffSucceeded(&tzResync);
+    trace(TraceEvent::TzFetchSucceeded);
+    applyTzInfo();
   }
 }
 
 /**
  * @brief make sure the timezone info is up-to-date
  *
- * if the request to the timezonedb.com API fails,
- * the ESP is rebooted. This gives it the chance to
- * reconnect to the WiFi or restart in AP mode
+ * computes the timezone info from the rule or starts the query to the
+ * timezonedb.com API. The query finishes from the loop(), until then the
+ * restored offset (or the one of the rule if none was restored) is shown
  *
+ * @param utc the current time as unix timestamp (UTC)
  */
-void updateTimeZoneInfo()
+void updateTimeZoneInfo(time_t utc)
 {
-  if (!getTzInfo(&tzInfo))
+#ifdef USE_TIMEZONEDB
+  if (!showRestoredTime)
   {
-#ifdef DEBUG
-    Serial.println("Failed to get TZ Info!");
-    Serial.println("Rebooting in 5 seconds");
+    // only a stand-in, keep it stale so the query is retried until it succeeded
+    getTzRuleInfo(tzRule, utc, &tzInfo);
+    tzInfo.validUntil = 0;
+  }
+  applyTzInfo();
+
+  tzFetchStart(config.timezoneName);
+#else
+  getTzRuleInfo(tzRule, utc, &tzInfo);
+  applyTzInfo();
 #endif
-    delay(5000);
+}
+
+void displayPasscode(char *apPasscode)
+{
+  static uint8_t currentDot = 0;
+  static bool direction = true;
+
+  // increment the currently lit dot in the current "direction"
+  direction ? currentDot++ : currentDot--;
 
-    // Best bet is to do a clean reboot so we can reconnect
-    // if we lost the WiFi connection or start the AP
-    // if the credentials are no longer valid
-    ESP.restart();
+  // change direction if we hit the first or last digit
+  if (currentDot == numDigits - 1 || currentDot == 0)
+  {
+    direction = !direction;
+  }
+
+  // convert the passcode into a tmElements_t
+  tmElements_t passcodeTime = {0,
+                               (uint8_t)((apPasscode[2] - '0') * 10 + (apPasscode[3] - '0')),
+                               (uint8_t)((apPasscode[0] - '0') * 10 + (apPasscode[1] - '0'))};
+
+  // update the display
+  uint8_t dotState = 0x01 << currentDot;
+  setDisplay(passcodeTime, dotState);
+}
+
+/**
+ * @brief show the passed local time on the display
+ */
+void displayLocalTime(time_t localTime)
+{
+  tmElements_t timeElements;
+  breakTime(localTime, timeElements);
+  setDisplay(timeElements);
+}
+
+/**
+ * @brief show the restored time or the passcode while connecting to the WiFi
+ */
+void displayConnecting(char *apPasscode)
+{
+  if (selfTestRunning)
+  {
+    return;
+  }
+
+  if (showRestoredTime)
+  {
+    displayLocalTime(now());
   }
   else
   {
-    // offset is specified in seconds, convert it to
-    // whole hours and seperate minutes for the NTPClient
-    if (!NTP.setTimeZone(tzInfo.offset / SECS_PER_HOUR, tzInfo.offset % SECS_PER_HOUR))
+    displayPasscode(apPasscode);
+  }
+}
+
+/**
+ * @brief called by the WiFiManager when the config portal is started
+ */
+void configPortalStarted(WiFiManager *)
+{
+  // the user needs to see the passcode to connect to the portal
+  showRestoredTime = false;
+}
+
+/**
+ * @brief show the next step of the self-test
+ *
+ * Called by the selfTestTicker, stops the ticker after the last step
+ */
+void selfTestStep()
+{
+  static uint8_t step = 0;
+  const uint8_t numSteps = 20;
+
+  // count up, colon off, then count down, colon on. Dots alternate
+  bool countUp = step < 10;
+  uint8_t i = countUp ? step : (numSteps - 1) - step;
+  uint8_t digits[numDigits];
+  memset(digits, i, numDigits);
+  const uint8_t allDots = (1 << numDigits) - 1;
+  setDisplayDigits(digits, i % 2 ? allDots : 0x00, !countUp);
+
+  if (++step == numSteps)
+  {
+    step = 0;
+    selfTestTicker.detach();
+    selfTestRunning = false;
+  }
+}
+
+/**
+ * @brief start the self-test cycling through all digits
+ *
+ * The test runs in the background, in parallel to the WiFi and NTP
+ * bring-up. The display is not updated by anything else while it runs
+ */
+void startSelfTest()
+{
+  selfTestRunning = true;
+  selfTestStep();
+  selfTestTicker.attach_ms(selfTestStepMs, selfTestStep);
+}
+
+/**
+ * @brief check if the self-test should run for the reason of the last reset
+ */
+bool selfTestWanted()
+{
+  switch (selfTestMode)
+  {
+  case SelfTestMode::Always:
+    return true;
+  case SelfTestMode::ColdBoot:
+  {
+    uint32_t reason = ESP.getResetInfoPtr()->reason;
+    return reason == REASON_DEFAULT_RST || reason == REASON_EXT_SYS_RST;
+  }
+  case SelfTestMode::Never:
+    break;
+  }
+  return false;
+}
+
+/**
+ * @brief serve the stats of the display refresh and the loop()
+ */
+void handleStatsRequest()
+{
+  static char json[640];
+  formatStats(json, sizeof(json));
+  server.send(200, "application/json", json);
+}
+
+/**
+ * @brief called by the NTPClient with the result of every sync
+ */
+void ntpSyncEvent(NTPSyncEvent_t event)
+{
+  trace(TraceEvent::NtpSync, event);
+}
+
+/**
+ * @brief serve the events of the trace, the oldest first
+ *
+ * The events are sent one by one with the length computed up front,
+ * so the JSON is never assembled in RAM
+ */
+void handleTraceRequest()
+{
+  char json[80];
+  TraceRecord record;
+  size_t length = 2;
+  for (uint8_t index = 0; traceRead(index, &record); index++)
+  {
+    length += formatTraceRecord(record, json, sizeof(json)) + (index ? 1 : 0);
+  }
+
+  server.setContentLength(length);
+  server.send(200, "application/json", "");
+  server.sendContent("[");
+  for (uint8_t index = 0; traceRead(index, &record); index++)
+  {
+    if (index)
     {
-#ifdef DEBUG
-      Serial.println("Failed to set timezone!");
-#endif
+      server.sendContent(",");
     }
-    else
+    formatTraceRecord(record, json, sizeof(json));
+    server.sendContent(json);
+  }
+  server.sendContent("]");
+}
+
+// the stats of the tasks, shared by the HTTP request and the serial
+// command (both only run from the loop())
+static char tasksJson[1280];
+
+/**
+ * @brief serve the measured runs of the tasks of the loop()
+ */
+void handleTasksRequest()
+{
+  formatTasks(tasksJson, sizeof(tasksJson));
+  server.send(200, "application/json", tasksJson);
+}
+
+/**
+ * @brief start syncing the time, the first sync is done right away
+ */
+void startNtp()
+{
+  // start with the current offset (and thus the current local time)
+  NTP.begin(ntpServer, tzInfo.offset / SECS_PER_HOUR, false, (tzInfo.offset % SECS_PER_HOUR) / SECS_PER_MIN);
+  NTP.setInterval(63);
+  ntpRunning = true;
+}
+
+/**
+ * @brief set up the power saving of the WiFi once it is connected
+ */
+void beginPowerMode()
+{
+  switch (powerMode)
+  {
+  case PowerMode::AlwaysOn:
+    WiFi.setSleepMode(WIFI_NONE_SLEEP);
+    break;
+  case PowerMode::ModemSleep:
+    WiFi.setSleepMode(WIFI_MODEM_SLEEP, modemSleepListenInterval);
+    break;
+  case PowerMode::RadioOff:
+    // the radio is awake since the boot, this is the first awake window
+    radioSwitchedAt = millis();
+    break;
+  }
+}
+
+/**
+ * @brief turn the radio off between the syncs in PowerMode::RadioOff
+ *
+ * The radio is turned off once the time was synced and no timezone info
+ * query is needed anymore, or if the sync did not succeed until
+ * radioMaxAwakeMs. It is woken after radioOffMs or when the timezone info
+ * has to be queried
+ *
+ * @param networkNeeded true while the timezone info needs to be queried
+ */
+void serviceRadio(bool networkNeeded)
+{
+  if (powerMode != PowerMode::RadioOff)
+  {
+    return;
+  }
+
+  uint32_t sinceSwitchMs = millis() - radioSwitchedAt;
+  if (radioOn)
+  {
+    // NTP can only sync once reconnected, begin() syncs right away
+    if (!ntpRunning && WiFi.isConnected())
+    {
+      startNtp();
+    }
+
+    bool synced = ntpRunning && NTP.getLastNTPSync() != syncBeforeWake;
+    if ((synced && !networkNeeded && sinceSwitchMs >= radioMinAwakeMs) || sinceSwitchMs >= radioMaxAwakeMs)
     {
 #ifdef DEBUG
-      Serial.print("New Timezone offset: ");
-      Serial.print(NTP.getTimeZone());
-      Serial.print(" hours and ");
-      Serial.print(NTP.getTimeZoneMinutes());
-      Serial.println(" minutes.");
+      Serial.println("Turning off the radio");
 #endif
+      // a sync with the radio off would only wait for the timeout
+      NTP.stop();
+      ntpRunning = false;
+      WiFi.mode(WIFI_OFF);
+      WiFi.forceSleepBegin();
+      radioOn = false;
+      radioSwitchedAt = millis();
     }
   }
+  else if (sinceSwitchMs >= radioOffMs || networkNeeded)
+  {
+#ifdef DEBUG
+    Serial.println("Waking the radio");
+#endif
+    // reconnects with the credentials saved by the WiFiManager
+    WiFi.forceSleepWake();
+    WiFi.mode(WIFI_STA);
+    WiFi.begin();
+    syncBeforeWake = NTP.getLastNTPSync();
+    radioOn = true;
+    radioSwitchedAt = millis();
+  }
 }
 
+#ifdef OTA_PASSWORD
 /**
- * @brief shift out the actual display data to the shift registers
+ * @brief show the progress of an OTA update on the two rightmost tubes
  *
- * This method is seperate from setDisplay() because it needs to be fast
- * to be able to simulate a PWM with a 50% duty cycle
+ * Called by ArduinoOTA for every received chunk
+ */
+void displayOtaProgress(unsigned int progress, unsigned int total)
+{
+  // 100% is only reached right before the reboot
+  uint32_t percent = total > 0 ? (uint64_t)progress * 100 / total : 0;
+  if (percent > 99)
+  {
+    percent = 99;
+  }
+  if (percent == shownOtaPercent)
+  {
+    return;
+  }
+  shownOtaPercent = percent;
+
+  // the other tubes stay dark, the colon is lit while the update runs
+  uint8_t digits[numDigits];
+  memset(digits, 10, numDigits);
+  digits[numDigits - 2] = percent / 10;
+  digits[numDigits - 1] = percent % 10;
+  setDisplayDigits(digits, 0x00, true, false);
+}
+
+/**
+ * @brief called by ArduinoOTA when an update starts
  */
-void updateDisplay()
+void otaStarted()
 {
-  // count the number of cycles the digits and dots are on
-  static uint8_t digitPwmCounter = 0;
-  static uint8_t ledPwmCounter = 0;
+  // don't let the radio sleep between the chunks
+  WiFi.setSleepMode(WIFI_NONE_SLEEP);
+  trace(TraceEvent::OtaStart);
+  shownOtaPercent = UINT8_MAX;
+  displayOtaProgress(0, 1);
+}
 
-  // the actual stream to shift out this cycle (with potential masking)
-  uint64_t maskedStream = displaySerialStream;
+/**
+ * @brief called by ArduinoOTA when an update failed, the old firmware keeps running
+ */
+void otaFailed(ota_error_t error)
+{
+#ifdef DEBUG
+  Serial.print("OTA update failed: ");
+  Serial.println(error);
+#endif
+  trace(TraceEvent::OtaError, error);
+  // back to the clock, the time is shown again in the next second
+  beginPowerMode();
+}
+
+/**
+ * @brief accept firmware updates over the network (pio run -t upload with espota)
+ *
+ * The update is received within ArduinoOTA.handle(), which blocks the loop()
+ * until it is done. The refresh keeps running from the timer1 ISR: it and its
+ * tables are in RAM, so it is not held off while the flash is erased and written
+ */
+void beginOta()
+{
+  ArduinoOTA.setHostname(hostName);
+  ArduinoOTA.setPassword(OTA_PASSWORD);
+
+  ArduinoOTA.onStart(otaStarted);
+  ArduinoOTA.onProgress(displayOtaProgress);
+  ArduinoOTA.onError(otaFailed);
+
+  // the mDNS responder is already started, only announce the OTA service
+  ArduinoOTA.begin(false);
+  MDNS.enableArduino(8266, true);
+}
+#endif
 
-  // mask out the digits if the counter reaches the brightness level
-  if (digitPwmCounter >= digitBrightness)
+/**
+ * @brief true if the time and timezone info are set by the leader of the fleet
+ */
+bool followingFleet()
+{
+#ifdef USE_FLEET
+  return fleetRole() == FleetRole::Follower;
+#else
+  return false;
+#endif
+}
+
+#ifdef USE_FLEET
+/**
+ * @brief follow the time of the leader and only sync with NTP without one
+ *
+ * @param utc the current time as unix timestamp (UTC)
+ */
+void serviceFleet(time_t utc)
+{
+  // the clock can only lead once it synced on its own
+  bool synced = ntpRunning && timeStatus() == timeSet && tzInfo.validUntil >= utc;
+
+  FleetTime fleetTime;
+  if (fleetService(synced, &fleetTime))
   {
-    maskedStream &= ~digitsMask;
+    // the flash is only touched if the timezone info changed
+    if (fleetTime.tzInfo.offset != tzInfo.offset || fleetTime.tzInfo.dstInEffect != tzInfo.dstInEffect ||
+        fleetTime.tzInfo.validUntil != tzInfo.validUntil)
+    {
+      tzInfo = fleetTime.tzInfo;
+      applyTzInfo();
+    }
+    // the packet is sent right after the second of the leader changed,
+    // its second started about when the packet arrived
+    setTime(fleetTime.utc + tzInfo.offset);
+    secondPhase = {true, fleetTime.utc, millis(), 0};
   }
-  // increase the counter
-  digitPwmCounter = (digitPwmCounter + 1) % (maxBrightness + 1);
 
-  // mask out the digits if the counter reaches the brightness level
-  if (ledPwmCounter >= ledBrightness)
+  // neither poll pool.ntp.org nor wait for its timeouts while following
+  bool ntpWanted = !followingFleet();
+  if (ntpWanted && !ntpRunning)
+  {
+    startNtp();
+  }
+  else if (!ntpWanted && ntpRunning)
   {
-    maskedStream &= ~ledsMask;
+    NTP.stop();
+    ntpRunning = false;
   }
-  // increase the counter
-  ledPwmCounter = (ledPwmCounter + 1) % (maxBrightness + 1);
+}
+#endif
 
-  // set latch pin low to avoid displaying the shifting of data
-  digitalWrite(latchPin, LOW);
+/**
+ * @brief measure the start of the second by SNTP while syncing on its own
+ *
+ * The followers of the fleet get it from the packets of the leader instead
+ */
+void serviceSecondPhase()
+{
+  static uint32_t probedAt = 0;
+  static bool probed = false;
 
-  // shift out the data big-endian (MSByte and MSBit) first
-  // (network order)
-  for (int8_t chip = numChips - 1; chip >= 0; chip--)
+  if (phaseProbeService(&secondPhase))
   {
-    uint8_t dataByte = (maskedStream >> (chip * 8)) & 0xFF;
-    shiftOut(dataPin, clockPin, MSBFIRST, dataByte);
-#ifdef DEBUG_DISPLAY
-    Serial.print("Chip ");
-    Serial.print(chip);
-    Serial.print(" set to state ");
-    Serial.println(String(dataByte, BIN));
-#endif
+    trace(TraceEvent::PhaseMeasured, secondPhase.delayMs);
+  }
+  if (secondPhase.valid && millis() - secondPhase.atMillis > phaseMaxAgeMs)
+  {
+    secondPhase.valid = false;
   }
 
-  // latch the temp register into the output
-  digitalWrite(latchPin, HIGH);
+  uint32_t intervalMs = secondPhase.valid ? phaseProbeIntervalMs : phaseRetryMs;
+  if (ntpRunning && WiFi.isConnected() && !phaseProbeRunning() && (!probed || millis() - probedAt >= intervalMs))
+  {
+    probed = true;
+    probedAt = millis();
+    phaseProbeStart(ntpServer);
+  }
 }
 
 /**
- * @brief Display the passed time on the nixie display
- * Shifts out the bit pattern to display the passed
- * time digits on the nixie display
+ * @brief check if the hour is within the low-brightness period of the config
  *
- * @param time time to display
+ * The period may wrap around midnight, it is empty if it begins and ends
+ * at the same hour
  */
-void setDisplay(tmElements_t time, uint8_t dots = 0x00)
+bool isLowBrightnessHour(uint8_t hour)
 {
-  // reset the display stream
-  displaySerialStream = 0x00;
+  if (config.beginLowBrightnessHour <= config.endLowBrightnessHour)
+  {
+    return hour >= config.beginLowBrightnessHour && hour < config.endLowBrightnessHour;
+  }
+  return hour >= config.beginLowBrightnessHour || hour < config.endLowBrightnessHour;
+}
 
-  // set the 4 digits
-  displaySerialStream |= 1ull << digitsPinmap[0][time.Hour / 10];
-  displaySerialStream |= 1ull << digitsPinmap[1][time.Hour % 10];
-  displaySerialStream |= 1ull << digitsPinmap[2][time.Minute / 10];
-  displaySerialStream |= 1ull << digitsPinmap[3][time.Minute % 10];
+/**
+ * @brief serve the current time and timezone info
+ */
+void handleStatusRequest()
+{
+  static char json[256];
+  const char *status = timeStatus() == timeSet ? "set" : (timeStatus() == timeNeedsSync ? "needsSync" : "notSet");
+  snprintf(json, sizeof(json),
+           "{\"time\":%u,\"utc\":%u,\"offset\":%d,\"dst\":%s,\"validUntil\":%u,\"timeStatus\":\"%s\",\"rssi\":%d,"
+           "\"secondAligned\":%s,\"phaseDelayMs\":%u,\"displayLagMs\":%d}",
+           (uint32_t)now(), (uint32_t)(now() - tzInfo.offset), tzInfo.offset, tzInfo.dstInEffect ? "true" : "false",
+           (uint32_t)tzInfo.validUntil, status, WiFi.RSSI(), secondPhase.valid ? "true" : "false", secondPhase.delayMs,
+           displayLagMs);
+  server.send(200, "application/json", json);
+}
+
+/**
+ * @brief serve the current config
+ */
+void handleConfigRequest()
+{
+  static char json[256];
+  snprintf(json, sizeof(json),
+           "{\"timezone\":\"%s\",\"rule\":\"%s\",\"beginLowBrightnessHour\":%u,\"endLowBrightnessHour\":%u,"
+           "\"dayLevel\":%u,\"nightLevel\":%u,\"antiPoisoning\":%s}",
+           config.timezoneName, config.timezoneRule, config.beginLowBrightnessHour, config.endLowBrightnessHour,
+           config.dayLevel, config.nightLevel, config.antiPoisoning ? "true" : "false");
+  server.send(200, "application/json", json);
+}
 
-  // set the outputs for the passed dot-state
-  for (uint8_t dot = 0; dot < numDigits; dot++)
+/**
+ * @brief parse an unsigned number of a request
+ *
+ * @param[out] out the number, only written if it is valid
+ * @return true if the number is valid and not larger than maxValue
+ */
+bool parseNumberArg(const String &arg, uint32_t maxValue, uint32_t *out)
+{
+  char *end;
+  unsigned long value = strtoul(arg.c_str(), &end, 10);
+  if (arg.length() == 0 || *end != '\0' || value > maxValue)
   {
-    if ((dots >> dot) & 0b1)
+    return false;
+  }
+  *out = value;
+  return true;
+}
+
+/**
+ * @brief copy a string argument of a request to a field of the config
+ *
+ * Only characters that need no escaping in the JSON and the query to the
+ * timezonedb.com API are accepted. The rest of the field is zeroed, so only
+ * a changed value writes the flash
+ *
+ * @return true if the string is valid and fits the field
+ */
+bool copyStringArg(const String &arg, char *field, size_t size)
+{
+  if (arg.length() == 0 || arg.length() >= size)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < arg.length(); i++)
+  {
+    char c = arg[i];
+    if (!isalnum(c) && !strchr("_/+-,.:<>", c))
     {
-      displaySerialStream |= 1ull << dotsPinmap[dot];
+      return false;
     }
   }
+  strncpy(field, arg.c_str(), size);
+  return true;
+}
+
+/**
+ * @brief change the config with the form fields of the request
+ *
+ * All fields are optional, nothing is changed if any of them is invalid.
+ * The flash is written later from the loop(), a request never waits for it
+ */
+void handleConfigUpdate()
+{
+  ClockConfig updated = config;
+  TzRule rule = tzRule;
+  uint32_t value = 0;
+  const char *error = nullptr;
 
-  // blink the LED seperator every other second
-  if (time.Second % 2)
+  if (server.hasArg("timezone") &&
+      !copyStringArg(server.arg("timezone"), updated.timezoneName, sizeof(updated.timezoneName)))
   {
-    displaySerialStream |= (1ull << ledsPinmap[0]);
-    displaySerialStream |= (1ull << ledsPinmap[1]);
+    error = "invalid timezone";
+  }
+  if (server.hasArg("rule") &&
+      (!copyStringArg(server.arg("rule"), updated.timezoneRule, sizeof(updated.timezoneRule)) ||
+       !parseTzRule(updated.timezoneRule, &rule)))
+  {
+    error = "invalid rule";
+  }
+  if (server.hasArg("beginLowBrightnessHour"))
+  {
+    if (!parseNumberArg(server.arg("beginLowBrightnessHour"), 23, &value))
+    {
+      error = "invalid beginLowBrightnessHour";
+    }
+    updated.beginLowBrightnessHour = value;
+  }
+  if (server.hasArg("endLowBrightnessHour"))
+  {
+    if (!parseNumberArg(server.arg("endLowBrightnessHour"), 23, &value))
+    {
+      error = "invalid endLowBrightnessHour";
+    }
+    updated.endLowBrightnessHour = value;
+  }
+  if (server.hasArg("dayLevel"))
+  {
+    if (!parseNumberArg(server.arg("dayLevel"), maxDisplayLevel, &value))
+    {
+      error = "invalid dayLevel";
+    }
+    updated.dayLevel = value;
+  }
+  if (server.hasArg("nightLevel"))
+  {
+    if (!parseNumberArg(server.arg("nightLevel"), maxDisplayLevel, &value))
+    {
+      error = "invalid nightLevel";
+    }
+    updated.nightLevel = value;
+  }
+  if (server.hasArg("antiPoisoning"))
+  {
+    if (!parseNumberArg(server.arg("antiPoisoning"), 1, &value))
+    {
+      error = "invalid antiPoisoning";
+    }
+    updated.antiPoisoning = value;
   }
 
-#ifdef DEBUG
-  Serial.print("setting display to ");
-  Serial.print(time.Hour);
-  Serial.print(time.Second % 2 ? ":" : " ");
-  Serial.println(String(time.Minute));
-#endif
+  if (error)
+  {
+    server.send(400, "text/plain", error);
+    return;
+  }
 
-  // make sure the updated display state is actually displayed
-  updateDisplay();
+  // the timezone info is recomputed (or queried) from the loop() in the
+  // next second if the zone changed
+  if (strcmp(updated.timezoneName, config.timezoneName) != 0 ||
+      strcmp(updated.timezoneRule, config.timezoneRule) != 0)
+  {
+    tzRule = rule;
+    tzInfo.validUntil = 0;
+  }
+
+  if (memcmp(&updated, &config, sizeof(config)) != 0)
+  {
+    config = updated;
+    configDirty = true;
+    configChangedAt = millis();
+  }
+  handleConfigRequest();
 }
 
-void displayPasscode(char *apPasscode)
+/**
+ * @brief handle at most one request of the HTTP server
+ *
+ * A request that took longer than httpSliceUs pauses the server
+ * for the time it took
+ */
+void serviceHttp()
 {
-  static uint8_t currentDot = 0;
-  static bool direction = true;
-
-  // increment the currently lit dot in the current "direction"
-  direction ? currentDot++ : currentDot--;
+  static uint32_t pausedUntil = 0;
+  static bool paused = false;
 
-  // change direction if we hit the first or last digit
-  if (currentDot == numDigits - 1 || currentDot == 0)
+  uint32_t startedAt = micros();
+  if (paused && (int32_t)(startedAt - pausedUntil) < 0)
   {
-    direction = !direction;
+    return;
   }
+  paused = false;
 
-  // convert the passcode into a tmElements_t
-  tmElements_t passcodeTime = {0,
-                               (uint8_t)((apPasscode[2] - '0') * 10 + (apPasscode[3] - '0')),
-                               (uint8_t)((apPasscode[0] - '0') * 10 + (apPasscode[1] - '0'))};
+  server.handleClient();
 
-  // update the display
-  uint8_t dotState = 0x01 << currentDot;
-  setDisplay(passcodeTime, dotState);
+  uint32_t tookUs = micros() - startedAt;
+  statsHttp(tookUs);
+  if (tookUs > httpSliceUs)
+  {
+    pausedUntil = startedAt + 2 * tookUs;
+    paused = true;
+  }
 }
 
-void displayTest()
+/**
+ * @brief handle commands on the serial port
+ *
+ * s: print the stats, t: print the stats of the tasks, e: print the events
+ * of the trace, r: reset the maxima, histograms and the missed deadlines
+ */
+void handleSerialCommands()
 {
-  // count up, colon off, dots alternate
-  for (int8_t i = 0; i < 10; i++)
+  while (Serial.available())
   {
-    uint8_t doubleDigit = (i * 10) + i;
-    tmElements_t testDisplay = {0, doubleDigit, doubleDigit};
-    setDisplay(testDisplay, i % 2 ? 0b1111 : 0b0000);
-    delay(300);
+    switch (Serial.read())
+    {
+    case 's':
+    {
+      static char json[640];
+      formatStats(json, sizeof(json));
+      Serial.println(json);
+      break;
+    }
+    case 't':
+      formatTasks(tasksJson, sizeof(tasksJson));
+      Serial.println(tasksJson);
+      break;
+    case 'e':
+    {
+      char json[80];
+      TraceRecord record;
+      for (uint8_t index = 0; traceRead(index, &record); index++)
+      {
+        formatTraceRecord(record, json, sizeof(json));
+        Serial.println(json);
+      }
+      break;
+    }
+    case 'r':
+      statsReset();
+      schedulerReset();
+      break;
+    }
   }
+}
+
+/**
+ * @brief start syncing and serving once the WiFi is connected
+ *
+ * Called from the setup() if the saved credentials worked right away,
+ * otherwise from the loop() once the config portal connected the WiFi
+ */
+void beginNetwork()
+{
+  connectingTicker.detach();
+  networkUp = true;
+  trace(TraceEvent::NetworkUp);
 
-  // count down, colon on, dots alternate
-  for (int8_t i = 9; i >= 0; i--)
+#ifdef USE_FLEET
+  fleetBegin();
+#endif
+
+  // a follower gets the time and the timezone info from the leader
+  if (!followingFleet())
   {
-    uint8_t doubleDigit = (i * 10) + i;
-    tmElements_t testDisplay = {1, doubleDigit, doubleDigit};
-    setDisplay(testDisplay, i % 2 ? 0b1111 : 0b0000);
-    delay(300);
+    // start with the restored offset (and thus the restored local time)
+    startNtp();
+
+    // initially get the timezone info if the restored one is not valid anymore
+    time_t currentUtc = now() - tzInfo.offset;
+    if (showRestoredTime && tzInfo.validUntil >= currentUtc)
+    {
+      applyTzInfo();
+    }
+    else
+    {
+      updateTimeZoneInfo(currentUtc);
+    }
   }
+  showRestoredTime = false;
+
+  beginPowerMode();
+
+  server.on("/stats", handleStatsRequest);
+  server.on("/tasks", handleTasksRequest);
+  server.on("/trace", handleTraceRequest);
+  server.on("/status", HTTP_GET, handleStatusRequest);
+  server.on("/config", HTTP_GET, handleConfigRequest);
+  server.on("/config", HTTP_POST, handleConfigUpdate);
+  server.begin();
+  MDNS.addService("http", "tcp", httpPort);
+
+#ifdef OTA_PASSWORD
+  beginOta();
+#endif
 }
 
-void setup()
+/**
+ * @brief update all the data and the display once a second passed
+ *
+ * The display task, checked on every pass of the loop() so the seconds flip
+ * right at their (measured) start. The display is only updated once the
+ * self-test or the slot machine released it
+ */
+void updateSecond()
 {
-  // setup GPIO data directions
-  pinMode(latchPin, OUTPUT);
-  pinMode(clockPin, OUTPUT);
-  pinMode(dataPin, OUTPUT);
+  static time_t lastUpdate = 0;
+
+  // the NTPClient returns the local time. It sets the whole second when its
+  // response arrives, so TimeLib flips the seconds up to a second late. The
+  // display flips them at the measured start of the second instead
+  time_t currentTime = phaseLocalTime(secondPhase, millis(), now(), tzInfo.offset);
+  time_t currentUtc = currentTime - tzInfo.offset;
+  if (currentTime == lastUpdate)
+  {
+    return;
+  }
+
+#ifdef USE_FLEET
+  // right after the second changed, so the followers change it in step
+  fleetAnnounce(currentUtc, tzInfo);
+#endif
 
 #ifdef DEBUG
-  // setup the debug serial port
-  Serial.begin(115200);
+  Serial.print("current time: ");
+  Serial.println(NTP.getTimeDateString());
 #endif
 
-  // set the outputs to a known state ASAP
-  displayTest();
+  // handle updates to the timezone info if it is no longer valid
+  if (tzInfo.validUntil < currentUtc && !followingFleet())
+  {
+#ifdef DEBUG
+    Serial.println("TZ Info no longer valid, updating...");
+#endif
 
-  // auto-manage wifi configuration
+#ifdef USE_TIMEZONEDB
+    // with the radio off the query waits until it is woken and connected
+    if (networkUp && !tzFetchRunning() && backoffDue(tzResync, millis()) &&
+        (powerMode != PowerMode::RadioOff || WiFi.isConnected()))
+    {
+      tzFetchStart(config.timezoneName);
+    }
+#else
+    updateTimeZoneInfo(currentUtc);
+#endif
+  }
+#ifdef DEBUG
+  else
+  {
+    Serial.print("TZ Info still valid for ");
+    Serial.print(tzInfo.validUntil - currentUtc);
+    Serial.print(" seconds or until: ");
+    Serial.println(NTP.getTimeDateString(tzInfo.validUntil));
+
+    Serial.print("current offset: ");
+    Serial.print(tzInfo.offset);
+    Serial.print(" seconds, ");
+    Serial.println(tzInfo.dstInEffect ? "DST active" : "DST inactive");
+  }
+#endif
 
-  // create a random numeric 4-digit password
-  String apPasscode = String(random(1000, 10000), DEC);
+  tmElements_t timeElements;
+  breakTime(currentTime, timeElements);
+  bool lowBrightness = isLowBrightnessHour(timeElements.Hour);
 
-#ifdef DEBUG
-  Serial.print("Random accesspoint password is: ");
-  Serial.println(apPasscode);
+  // spin the tubes once per hour at night, when nobody looks at the clock
+  static int8_t antiPoisoningHour = -1;
+  if (config.antiPoisoning && lowBrightness && timeElements.Minute == 0 && timeElements.Hour != antiPoisoningHour &&
+      timeStatus() != timeNotSet && !selfTestRunning)
+  {
+    antiPoisoningHour = timeElements.Hour;
+    slotMachineStart(antiPoisoningMs);
+  }
+
+  // the connectingTicker shows the passcode while the portal is open
+  if (!selfTestRunning && !slotMachineRunning() && networkUp)
+  {
+    setDisplay(timeElements);
+    // the refresh shows the new planes within one period
+    displayLagMs = secondPhase.valid ? (int32_t)phaseMsIntoSecond(secondPhase, millis()) : -1;
+  }
+
+  lastUpdate = currentTime;
+
+  // keep the time for a fast startup after a soft reset
+  if (timeStatus() != timeNotSet)
+  {
+    saveRtcTime(currentUtc);
+    traceSetTime(currentUtc);
+  }
+
+#ifndef USE_AMBIENT_LIGHT
+  // set the brightness depending on the current time. Only a changed level
+  // is applied, setDisplayLevel() waits for the refresh to pick up the planes
+  static int32_t appliedLevel = -1;
+  uint16_t level = lowBrightness ? config.nightLevel : config.dayLevel;
+  if (level != appliedLevel)
+  {
+    setDisplayLevel(level, level);
+    appliedLevel = level;
+  }
 #endif
+}
 
-  // start to display the connecting animation and passcode
-  connectingTicker.attach(0.5, displayPasscode, const_cast<char *>(apPasscode.c_str()));
-  if (!MDNS.begin("nixie"))
+#ifdef USE_AMBIENT_LIGHT
+/**
+ * @brief follow the ambient light
+ *
+ * The ADC is only read from here at a low rate, never from the refresh ISR.
+ * The display is only touched if the level changed beyond the hysteresis
+ */
+void serviceAmbientLight()
+{
+  if (ambientLightDue(ambientLight, millis()) &&
+      ambientLightUpdate(&ambientLight, ambientLightConfig, analogRead(A0), millis()))
   {
-#ifdef DEBUG
-    Serial.println("Error setting up MDNS responder!");
+    setDisplayLevel(ambientLight.level, ambientLight.level);
+  }
+}
 #endif
+
+/**
+ * @brief advance the animation frame by frame, it never blocks the loop()
+ */
+void serviceAnimation()
+{
+  slotMachineService(now());
+}
+
+/**
+ * @brief the network services besides the HTTP server, or the config
+ * portal until the WiFi is connected
+ */
+void serviceNetwork()
+{
+  MDNS.update();
+
+  if (!networkUp)
+  {
+    // the portal closes once the WiFi is connected with the new credentials
+    if (wifiManager.process())
+    {
+      beginNetwork();
+    }
+    return;
   }
 
-  // repeat the passcode twice to get the 8 char minimum length
-  wifiManager.autoConnect("Nixie Clock", (apPasscode + apPasscode).c_str());
-  connectingTicker.detach();
+#ifdef OTA_PASSWORD
+  ArduinoOTA.handle();
+#endif
+  serviceSecondPhase();
 
-  NTP.begin("pool.ntp.org");
+  time_t currentUtc = now() - tzInfo.offset;
+#ifdef USE_FLEET
+  serviceFleet(currentUtc);
+#endif
 
-  // initially get the timezone info
-  updateTimeZoneInfo();
+#ifdef USE_TIMEZONEDB
+  serviceRadio(tzInfo.validUntil < currentUtc || tzFetchRunning());
+#else
+  (void)currentUtc;
+  serviceRadio(false);
+#endif
+}
 
-  NTP.setInterval(63);
+#ifdef USE_TIMEZONEDB
+/**
+ * @brief advance a running timezone info query for a bounded time slice
+ */
+void serviceTzFetch()
+{
+  if (tzFetchRunning())
+  {
+    TzFetchResult result = tzFetchService(&tzInfo, tzFetchSliceUs);
+    if (result != TzFetchResult::Pending)
+    {
+      handleTzFetchResult(result);
+    }
+  }
 }
+#endif
 
-void loop()
+/**
+ * @brief save a changed config once it settled, never from within a request
+ */
+void serviceConfigSave()
 {
-  static time_t lastUpdate = 0;
+  if (configDirty && millis() - configChangedAt >= configSaveDelayMs)
+  {
+    saveConfig(config);
+    configDirty = false;
+    trace(TraceEvent::ConfigSaved);
+  }
+}
+
+// the tasks of the loop() by priority: name, function, period (ms),
+// deadline (ms) and budget (µs). The display task is checked on every pass
+// and should see the start of the second within a few ms. Connecting to the
+// timezonedb.com API only has a timeout, but no budget
+const Task tasks[] = {
+    {"display", updateSecond, 0, 5, 5000},
+#ifdef USE_AMBIENT_LIGHT
+    {"ambientLight", serviceAmbientLight, 0, 50, 500},
+#endif
+    {"animation", serviceAnimation, 0, 20, 1000},
+    {"http", serviceHttp, 0, 100, httpSliceUs},
+    {"network", serviceNetwork, 0, 100, 5000},
+#ifdef USE_TIMEZONEDB
+    {"tzFetch", serviceTzFetch, 0, 100, tzFetchSliceUs + 1000},
+#endif
+    {"serial", handleSerialCommands, 100, 100, 1000},
+    {"config", serviceConfigSave, 1000, 1000, 100000},
+};
+static_assert(sizeof(tasks) / sizeof(tasks[0]) <= maxTasks, "too many tasks for the scheduler");
+
+void setup()
+{
+  system_update_cpu_freq(cpuFreqMHz);
+
+  // setup GPIO data directions (or the HSPI) and start refreshing the display
+  displayBegin();
 
-  time_t currentTime = now();
+  // setup the serial port for the stats and debug output
+  Serial.begin(115200);
 
-  // a second passed, update all the data and display
-  if (currentTime != lastUpdate)
+  // a config changed over the web API survives a reflash
+  persistenceBegin();
+  if (!loadConfig(&config))
   {
-    // make sure the display is always on before entering this (slow) loop
-    // so visible lanking of the display is avoided
-    // activate maximum brightness to ensure a display update
-    // will turn on the display and then update the display
-    digitBrightness = maxBrightness;
-    ledBrightness = maxBrightness;
-    updateDisplay();
+    config = defaultConfig;
+  }
 
+  // fall back to UTC if the rule is invalid
+  if (!parseTzRule(config.timezoneRule, &tzRule))
+  {
 #ifdef DEBUG
-    Serial.print("current time: ");
-    Serial.println(NTP.getTimeDateString());
+    Serial.print("Invalid timezone rule: ");
+    Serial.println(config.timezoneRule);
 #endif
+    parseTzRule("UTC0", &tzRule);
+  }
+
+  // after a soft reset the time in the RTC memory and the timezone in flash
+  // are still valid, show the time right away and resync in the background
+  time_t restoredUtc;
+  TzInfo restoredTzInfo;
+  if (loadRtcTime(&restoredUtc) && loadTzInfo(&restoredTzInfo))
+  {
+    tzInfo = restoredTzInfo;
+    setTime(restoredUtc + tzInfo.offset);
+    displayLocalTime(now());
+    showRestoredTime = true;
+    traceSetTime(restoredUtc);
+  }
+
+  // the events before the reset stay readable, the boot is traced with its reason
+  traceBegin(ESP.getResetInfoPtr()->reason);
+  NTP.onNTPSyncEvent(ntpSyncEvent);
+
+  // set the outputs to a known state ASAP
+  if (selfTestWanted())
+  {
+    startSelfTest();
+  }
+
+  // auto-manage wifi configuration
+
+  // create a random numeric 4-digit password
+  snprintf(apPasscode, sizeof(apPasscode), "%ld", random(1000, 10000));
 
-    // handle updates to the timezone info if it is no longer valid
-    if (tzInfo.validUntil < currentTime)
-    {
 #ifdef DEBUG
-      Serial.println("TZ Info no longer valid, updating...");
+  Serial.print("Random accesspoint password is: ");
+  Serial.println(apPasscode);
 #endif
 
-      updateTimeZoneInfo();
-    }
+  // start to display the connecting animation and passcode
+  connectingTicker.attach(0.5, displayConnecting, apPasscode);
+  wifiManager.setAPCallback(configPortalStarted);
+  if (!MDNS.begin(hostName))
+  {
 #ifdef DEBUG
-    else
-    {
-      Serial.print("TZ Info still valid for ");
-      Serial.print(tzInfo.validUntil - currentTime);
-      Serial.print(" seconds or until: ");
-      Serial.println(NTP.getTimeDateString(tzInfo.validUntil));
-
-      Serial.print("current offset: ");
-      Serial.print(tzInfo.offset);
-      Serial.print(" seconds, ");
-      Serial.println(tzInfo.dstInEffect ? "DST active" : "DST inactive");
-    }
+    Serial.println("Error setting up MDNS responder!");
 #endif
+  }
 
-    tmElements_t timeElements;
-    breakTime(currentTime, timeElements);
-    setDisplay(timeElements);
+  // repeat the passcode twice to get the 8 char minimum length. Without
+  // saved credentials (or if they fail) the portal is opened and served from
+  // the loop(), which keeps the clock running until the WiFi is configured
+  static char apPassword[2 * sizeof(apPasscode) - 1];
+  snprintf(apPassword, sizeof(apPassword), "%s%s", apPasscode, apPasscode);
+  wifiManager.setConfigPortalBlocking(false);
+  if (wifiManager.autoConnect("Nixie Clock", apPassword))
+  {
+    beginNetwork();
+  }
 
-    lastUpdate = currentTime;
+  schedulerBegin(tasks, sizeof(tasks) / sizeof(tasks[0]));
+}
 
-    // set the brightness depending on the current time.
-    if (timeElements.Hour >= beginLowBrightnessHour || timeElements.Hour < endLowBrightnessHour)
-    {
-      // set low-brightness mode
-      ledBrightness = lowBrightness;
-      digitBrightness = lowBrightness;
-    }
-    else
-    {
-      // clear low-brightness mode
-      ledBrightness = maxBrightness;
-      digitBrightness = maxBrightness;
-    }
+void loop()
+{
+  uint32_t stallUs = statsLoop();
+  if (stallUs > loopStallTraceUs)
+  {
+    trace(TraceEvent::LoopStall, min(stallUs / 1000, (uint32_t)UINT16_MAX));
   }
 
-  // update the display every cycle to be as fast as possible
-  // this should not be done with a ticker as the minimum resolution is
-  // 1ms, however an update only takes <=200µs, thus giving a better
-  // resolution for PWM mode.
-  updateDisplay();
+  // the display refresh runs from the timer1 ISR, nothing in here (or in any
+  // of the blocking network calls) can stall it. The budgets only bound how
+  // long the tasks keep each other from their work
+  schedulerRun(loopBudgetUs);
 }
@@ -0,0 +1,177 @@
+#include "persistence.h"
+
+#include <EEPROM.h>
+#include <coredecls.h>
+
+// marks a valid entry, changed whenever the layout of an entry changes
+const uint32_t persistenceMagic = 0x4E495831;
+
+// the time saved to the RTC memory is up to a second old
+// when the reset happens
+const time_t rtcTimeMaxAge = 1;
+
+typedef struct
+{
+  uint32_t magic;
+  TzInfo tzInfo;
+  uint32_t crc;
+} TzInfoEntry;
+
+typedef struct
+{
+  uint32_t magic;
+  ClockConfig config;
+  uint32_t crc;
+} ConfigEntry;
+
+// the time is split into two words, an int64_t would be 8 byte aligned
+// and pad the entry to 24 bytes
+typedef struct
+{
+  uint32_t magic;
+  uint32_t utcLow;
+  uint32_t utcHigh;
+  uint32_t crc;
+} RtcTimeEntry;
+static_assert(sizeof(RtcTimeEntry) == 4 * rtcTimeBlocks, "the time does not fit its blocks of the RTC user memory");
+
+// the layout of the emulated EEPROM. EEPROM.commit() erases the whole flash
+// sector and writes back only the size passed to EEPROM.begin(), so the
+// buffer covers all entries
+const size_t tzInfoOffset = 0;
+const size_t configOffset = tzInfoOffset + sizeof(TzInfoEntry);
+const size_t eepromSize = configOffset + sizeof(ConfigEntry);
+
+/**
+ * @brief checksum of an entry without its crc field
+ */
+template <typename T>
+static uint32_t entryCrc(const T &entry)
+{
+  return crc32(&entry, offsetof(T, crc));
+}
+
+void persistenceBegin()
+{
+  // the buffer is allocated once and kept, the entries are read from it
+  // and EEPROM.commit() writes it back
+  EEPROM.begin(eepromSize);
+}
+
+bool loadTzInfo(TzInfo *out)
+{
+  TzInfoEntry entry;
+  EEPROM.get(tzInfoOffset, entry);
+
+  if (entry.magic != persistenceMagic || entry.crc != entryCrc(entry))
+  {
+    return false;
+  }
+
+  *out = entry.tzInfo;
+  return true;
+}
+
+void saveTzInfo(const TzInfo &tzInfo)
+{
+  TzInfoEntry entry;
+  // avoid the padding of the struct to change the checksum
+  memset(&entry, 0x00, sizeof(entry));
+  entry.magic = persistenceMagic;
+  entry.tzInfo = tzInfo;
+  entry.crc = entryCrc(entry);
+
+  // EEPROM.put() only marks the data dirty if it changed, so
+  // EEPROM.commit() only writes the flash if the info changed
+  EEPROM.put(tzInfoOffset, entry);
+  EEPROM.commit();
+}
+
+bool loadConfig(ClockConfig *out)
+{
+  ConfigEntry entry;
+  EEPROM.get(configOffset, entry);
+
+  if (entry.magic != persistenceMagic || entry.crc != entryCrc(entry))
+  {
+    return false;
+  }
+
+  *out = entry.config;
+  // never trust the strings to be terminated
+  out->timezoneName[sizeof(out->timezoneName) - 1] = '\0';
+  out->timezoneRule[sizeof(out->timezoneRule) - 1] = '\0';
+  return true;
+}
+
+void saveConfig(const ClockConfig &config)
+{
+  ConfigEntry entry;
+  memset(&entry, 0x00, sizeof(entry));
+  entry.magic = persistenceMagic;
+  entry.config = config;
+  entry.crc = entryCrc(entry);
+
+  EEPROM.put(configOffset, entry);
+  EEPROM.commit();
+}
+
+/**
+ * @brief check if the time in the RTC memory is still valid after the reset
+ *
+ * The RTC memory also survives the reset pin (the reset button, or the
+ * auto-reset when flashing), but then the clock may have been held in reset
+ * for any time
+ */
+static bool rtcTimeSurvivedReset()
+{
+  switch (ESP.getResetInfoPtr()->reason)
+  {
+  case REASON_SOFT_RESTART:
+  case REASON_SOFT_WDT_RST:
+  case REASON_WDT_RST:
+  case REASON_EXCEPTION_RST:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool loadRtcTime(time_t *out)
+{
+  RtcTimeEntry entry;
+  if (!rtcTimeSurvivedReset())
+  {
+    // discard the entry, the time is unknown until the next sync
+    memset(&entry, 0x00, sizeof(entry));
+    ESP.rtcUserMemoryWrite(rtcTimeBlock, (uint32_t *)&entry, sizeof(entry));
+    return false;
+  }
+
+  if (!ESP.rtcUserMemoryRead(rtcTimeBlock, (uint32_t *)&entry, sizeof(entry)))
+  {
+    return false;
+  }
+
+  if (entry.magic != persistenceMagic || entry.crc != entryCrc(entry))
+  {
+    return false;
+  }
+
+  // account for the time the reset and boot took
+  time_t utc = (int64_t)((uint64_t)entry.utcHigh << 32 | entry.utcLow);
+  *out = utc + rtcTimeMaxAge + millis() / 1000;
+  return true;
+}
+
+void saveRtcTime(time_t utc)
+{
+  RtcTimeEntry entry;
+  memset(&entry, 0x00, sizeof(entry));
+  entry.magic = persistenceMagic;
+  entry.utcLow = (uint64_t)utc;
+  entry.utcHigh = (uint64_t)utc >> 32;
+  entry.crc = entryCrc(entry);
+
+  ESP.rtcUserMemoryWrite(rtcTimeBlock, (uint32_t *)&entry, sizeof(entry));
+}
@@ -0,0 +1,104 @@
+#include "scheduler.h"
+
+#include "json_format.h"
+
+static const Task *tasks = nullptr;
+static uint8_t taskCount = 0;
+static TaskStats taskStats[maxTasks];
+
+// the task the last pass stopped at for the budget, the next pass starts with it
+static uint8_t resumeAt = 0;
+
+void schedulerBegin(const Task *table, uint8_t count)
+{
+  tasks = table;
+  taskCount = min(count, maxTasks);
+
+  uint32_t nowMs = millis();
+  for (uint8_t task = 0; task < taskCount; task++)
+  {
+    memset(&taskStats[task], 0x00, sizeof(TaskStats));
+    taskStats[task].dueAt = nowMs;
+  }
+  resumeAt = 0;
+}
+
+void schedulerRun(uint32_t budgetUs)
+{
+  uint32_t passStart = micros();
+  bool ranAny = false;
+  uint8_t first = resumeAt;
+  resumeAt = 0;
+
+  for (uint8_t scanned = 0; scanned < taskCount; scanned++)
+  {
+    uint8_t task = (first + scanned) % taskCount;
+    TaskStats &state = taskStats[task];
+    uint32_t startMs = millis();
+    if ((int32_t)(startMs - state.dueAt) < 0)
+    {
+      continue;
+    }
+
+    // the rest waits for the next pass, it is still due then
+    uint32_t startUs = micros();
+    if (ranAny && startUs - passStart >= budgetUs)
+    {
+      resumeAt = task;
+      break;
+    }
+    ranAny = true;
+
+    uint32_t latenessMs = startMs - state.dueAt;
+    if (latenessMs > state.maxLatenessMs)
+    {
+      state.maxLatenessMs = latenessMs;
+    }
+    if (latenessMs > tasks[task].deadlineMs)
+    {
+      state.missedDeadlines++;
+    }
+
+    tasks[task].run();
+
+    uint32_t runUs = micros() - startUs;
+    state.runs++;
+    if (runUs > state.maxRunUs)
+    {
+      state.maxRunUs = runUs;
+    }
+    if (runUs > tasks[task].budgetUs)
+    {
+      state.overruns++;
+    }
+
+    // the period counts from the start of the run, a late run is not made up for.
+    // A task running on every pass is due again right after it returned
+    state.dueAt = tasks[task].periodMs > 0 ? startMs + tasks[task].periodMs : millis();
+  }
+}
+
+void schedulerReset()
+{
+  for (uint8_t task = 0; task < taskCount; task++)
+  {
+    taskStats[task].maxRunUs = 0;
+    taskStats[task].overruns = 0;
+    taskStats[task].missedDeadlines = 0;
+    taskStats[task].maxLatenessMs = 0;
+  }
+}
+
+size_t formatTasks(char *buffer, size_t size)
+{
+  size_t length = appendFormat(buffer, size, 0, "[");
+  for (uint8_t task = 0; task < taskCount; task++)
+  {
+    const TaskStats &state = taskStats[task];
+    length = appendFormat(buffer, size, length,
+                    "%s{\"name\":\"%s\",\"runs\":%u,\"maxRunUs\":%u,\"overruns\":%u,\"missed\":%u,\"maxLateMs\":%u}",
+                    task ? "," : "", tasks[task].name, state.runs, state.maxRunUs, state.overruns,
+                    state.missedDeadlines, state.maxLatenessMs);
+  }
+  return appendFormat(buffer, size, length, "]");
+}
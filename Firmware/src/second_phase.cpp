@@ -0,0 +1,124 @@
+#include "second_phase.h"
+
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+
+// the size of an SNTP message without the optional fields
+const uint8_t sntpPacketSize = 48;
+
+// the local port the response is received on
+const uint16_t sntpLocalPort = 2390;
+
+// the NTP timestamps count from 1900, unix timestamps from 1970
+const uint32_t ntpToUnixSeconds = 2208988800UL;
+
+// a response arriving later than this is not accurate enough anyway
+const uint32_t probeTimeoutMs = 1000;
+
+static WiFiUDP udp;
+static bool running = false;
+
+// micros() and millis() when the request was sent
+static uint32_t sentAtUs;
+static uint32_t sentAtMs;
+
+/**
+ * @brief read a big endian 32 bit word of the message
+ */
+static uint32_t readWord(const uint8_t *packet, uint8_t offset)
+{
+  return (uint32_t)packet[offset] << 24 | (uint32_t)packet[offset + 1] << 16 |
+         (uint32_t)packet[offset + 2] << 8 | packet[offset + 3];
+}
+
+/**
+ * @brief convert the fraction of an NTP timestamp to ms
+ */
+static uint32_t fractionToMs(uint32_t fraction)
+{
+  return ((uint64_t)fraction * 1000) >> 32;
+}
+
+bool phaseProbeStart(const char *server)
+{
+  IPAddress address;
+  if (!WiFi.hostByName(server, address))
+  {
+    return false;
+  }
+
+  // version 4, client mode. No timestamps are needed in the request
+  uint8_t packet[sntpPacketSize];
+  memset(packet, 0x00, sizeof(packet));
+  packet[0] = 0b00100011;
+
+  udp.begin(sntpLocalPort);
+  udp.beginPacket(address, 123);
+  udp.write(packet, sizeof(packet));
+  sentAtMs = millis();
+  sentAtUs = micros();
+  if (!udp.endPacket())
+  {
+    udp.stop();
+    return false;
+  }
+
+  running = true;
+  return true;
+}
+
+bool phaseProbeService(SecondPhase *out)
+{
+  if (!running)
+  {
+    return false;
+  }
+
+  if (millis() - sentAtMs > probeTimeoutMs)
+  {
+    udp.stop();
+    running = false;
+    return false;
+  }
+
+  if (udp.parsePacket() < sntpPacketSize)
+  {
+    return false;
+  }
+  uint32_t arrivedAtUs = micros();
+  uint32_t arrivedAtMs = millis();
+
+  uint8_t packet[sntpPacketSize];
+  bool read = udp.read(packet, sizeof(packet)) == sntpPacketSize;
+  udp.stop();
+  running = false;
+
+  // server mode, synchronized (stratum 1..15) and a transmit time set
+  uint8_t stratum = packet[1];
+  uint32_t transmitSeconds = readWord(packet, 40);
+  if (!read || (packet[0] & 0b111) != 4 || stratum == 0 || stratum > 15 || transmitSeconds == 0)
+  {
+    return false;
+  }
+
+  // the round trip without the time the server took to answer
+  uint32_t receiveSeconds = readWord(packet, 32);
+  uint32_t serverMs = (transmitSeconds - receiveSeconds) * 1000 +
+                      fractionToMs(readWord(packet, 44)) - fractionToMs(readWord(packet, 36));
+  uint32_t roundTripMs = (arrivedAtUs - sentAtUs) / 1000;
+  uint32_t delayMs = roundTripMs > serverMs ? roundTripMs - serverMs : 0;
+
+  // the transmit time plus the way back, assuming both ways take equally long
+  uint32_t msIntoSecond = fractionToMs(readWord(packet, 44)) + delayMs / 2;
+
+  out->valid = true;
+  out->utc = transmitSeconds - ntpToUnixSeconds + msIntoSecond / 1000;
+  out->atMillis = arrivedAtMs - msIntoSecond % 1000;
+  out->delayMs = delayMs > UINT16_MAX ? UINT16_MAX : delayMs;
+  return true;
+}
+
+bool phaseProbeRunning()
+{
+  return running;
+}
@@ -0,0 +1,83 @@
+#include "slot_machine.h"
+
+#include "display.h"
+
+// duration of a frame of the animation, every frame advances all spinning
+// tubes by one cathode. Much shorter than crossfadeMs, so frames are not faded
+const uint32_t slotMachineFrameMs = 50;
+
+// the tubes stop one after the other, each one after another full turn of
+// all cathodes, so every cathode of a tube is still lit equally long
+const uint32_t framesPerTurn = 10;
+
+// the time the last tube stops on is shown for this many frames
+const uint32_t landedFrames = 20;
+
+static bool running = false;
+
+// millis() when the animation was started
+static uint32_t startedAt;
+
+// number of frames all tubes spin, a multiple of framesPerTurn
+static uint32_t spinFrames;
+
+// the last frame shown
+static uint32_t shownFrame;
+
+void slotMachineStart(uint32_t durationMs)
+{
+  // whole turns only, otherwise the first cathodes of a turn would be lit longer
+  uint32_t turns = durationMs / (slotMachineFrameMs * framesPerTurn);
+  spinFrames = (turns > 0 ? turns : 1) * framesPerTurn;
+  startedAt = millis();
+  shownFrame = UINT32_MAX;
+  running = true;
+}
+
+void slotMachineService(time_t localTime)
+{
+  if (!running)
+  {
+    return;
+  }
+
+  uint32_t frame = (millis() - startedAt) / slotMachineFrameMs;
+  if (frame == shownFrame)
+  {
+    return;
+  }
+  shownFrame = frame;
+
+  if (frame >= spinFrames + numDigits * framesPerTurn + landedFrames)
+  {
+    running = false;
+    return;
+  }
+
+  tmElements_t time;
+  breakTime(localTime, time);
+  uint8_t landed[numDigits];
+  timeToDigits(time, landed);
+
+  uint8_t digits[numDigits];
+  for (uint8_t digit = 0; digit < numDigits; digit++)
+  {
+    // the leftmost tube stops first
+    if (frame >= spinFrames + (digit + 1) * framesPerTurn)
+    {
+      digits[digit] = landed[digit];
+    }
+    else
+    {
+      // the tubes are offset against each other to look less regular
+      digits[digit] = (frame + digit * 3) % framesPerTurn;
+    }
+  }
+
+  setDisplayDigits(digits, 0x00, false, false);
+}
+
+bool slotMachineRunning()
+{
+  return running;
+}
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "stats.h"
+
+#include "json_format.h"
+
+volatile Stats stats;
+
+// the rates are computed over this period
+const uint32_t statsRatePeriodMs = 1000;
+
+// frames, shifted frames and loop() iterations per second,
+// updated every statsRatePeriodMs
+static uint32_t framesPerSecond;
+static uint32_t shiftsPerSecond;
+static uint32_t loopsPerSecond;
+
+/**
+ * @brief sample the heap, called once per rate period from the loop()
+ */
+static void sampleHeap()
+{
+  static uint32_t historySamples = 0;
+  static uint32_t hourMinMaxFreeBlock = UINT32_MAX;
+
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t maxFreeBlock = ESP.getMaxFreeBlockSize();
+  uint8_t fragmentation = ESP.getHeapFragmentation();
+
+  stats.freeHeap = freeHeap;
+  stats.maxFreeBlock = maxFreeBlock;
+  stats.heapFragmentation = fragmentation;
+  // 0 until the first sample after the boot or a reset
+  if (stats.minFreeHeap == 0 || freeHeap < stats.minFreeHeap)
+  {
+    stats.minFreeHeap = freeHeap;
+  }
+  if (stats.minMaxFreeBlock == 0 || maxFreeBlock < stats.minMaxFreeBlock)
+  {
+    stats.minMaxFreeBlock = maxFreeBlock;
+  }
+  if (fragmentation > stats.maxHeapFragmentation)
+  {
+    stats.maxHeapFragmentation = fragmentation;
+  }
+
+  hourMinMaxFreeBlock = min(hourMinMaxFreeBlock, maxFreeBlock);
+  if (++historySamples * (statsRatePeriodMs / 1000) >= heapHistoryPeriodS)
+  {
+    for (uint8_t hour = statsBuckets - 1; hour > 0; hour--)
+    {
+      stats.heapHistory[hour] = stats.heapHistory[hour - 1];
+    }
+    stats.heapHistory[0] = hourMinMaxFreeBlock;
+    historySamples = 0;
+    hourMinMaxFreeBlock = UINT32_MAX;
+  }
+}
+
+uint32_t statsLoop()
+{
+  static uint32_t lastLoopAt = micros();
+  static uint32_t rateStartedAt = millis();
+  static uint32_t rateFrames = 0;
+  static uint32_t rateShifts = 0;
+  static uint32_t rateLoops = 0;
+
+  uint32_t loopAt = micros();
+  uint32_t stallUs = loopAt - lastLoopAt;
+  lastLoopAt = loopAt;
+
+  stats.loops++;
+  if (stallUs > stats.maxLoopStallUs)
+  {
+    stats.maxLoopStallUs = stallUs;
+  }
+  stats.loopHistogram[statsBucket(stallUs, loopHistogramFirstBit)]++;
+
+  if (millis() - rateStartedAt >= statsRatePeriodMs)
+  {
+    rateStartedAt += statsRatePeriodMs;
+    // the frame counters are only written by the ISR, a single read is atomic
+    uint32_t frames = stats.frames;
+    uint32_t shifts = stats.shifts;
+    framesPerSecond = frames - rateFrames;
+    shiftsPerSecond = shifts - rateShifts;
+    loopsPerSecond = stats.loops - rateLoops;
+    rateFrames = frames;
+    rateShifts = shifts;
+    rateLoops = stats.loops;
+
+    sampleHeap();
+  }
+
+  return stallUs;
+}
+
+void statsHttp(uint32_t us)
+{
+  if (us > stats.maxHttpUs)
+  {
+    stats.maxHttpUs = us;
+  }
+}
+
+void statsReset()
+{
+  noInterrupts();
+  stats.maxFrameCycles = 0;
+  stats.maxLoopStallUs = 0;
+  stats.maxHttpUs = 0;
+  stats.minFreeHeap = 0;
+  stats.minMaxFreeBlock = 0;
+  stats.maxHeapFragmentation = 0;
+  for (uint8_t bucket = 0; bucket < statsBuckets; bucket++)
+  {
+    stats.frameHistogram[bucket] = 0;
+    stats.loopHistogram[bucket] = 0;
+  }
+  interrupts();
+}
+
+/**
+ * @brief append a histogram as JSON array
+ */
+static size_t appendHistogram(char *buffer, size_t size, size_t length, const uint32_t *histogram)
+{
+  for (uint8_t bucket = 0; bucket < statsBuckets; bucket++)
+  {
+    length = appendFormat(buffer, size, length, "%s%u", bucket ? "," : "[", histogram[bucket]);
+  }
+  return appendFormat(buffer, size, length, "]");
+}
+
+size_t formatStats(char *buffer, size_t size)
+{
+  // copy the values written by the ISR at once for a consistent output
+  Stats snapshot;
+  noInterrupts();
+  memcpy(&snapshot, (const void *)&stats, sizeof(snapshot));
+  interrupts();
+
+  uint32_t cyclesPerUs = ESP.getCpuFreqMHz();
+  size_t length = appendFormat(buffer, size, 0, "{\"uptime\":%u,\"fps\":%u,\"shiftRate\":%u,\"frameUs\":%u,\"maxFrameUs\":%u,\"frameHistogram\":",
+                         (uint32_t)(millis() / 1000), framesPerSecond, shiftsPerSecond,
+                         snapshot.lastFrameCycles / cyclesPerUs, snapshot.maxFrameCycles / cyclesPerUs);
+  length = appendHistogram(buffer, size, length, snapshot.frameHistogram);
+  length = appendFormat(buffer, size, length, ",\"loopRate\":%u,\"maxLoopStallUs\":%u,\"loopHistogram\":",
+                  loopsPerSecond, snapshot.maxLoopStallUs);
+  length = appendHistogram(buffer, size, length, snapshot.loopHistogram);
+  length = appendFormat(buffer, size, length, ",\"maxHttpUs\":%u", snapshot.maxHttpUs);
+  length = appendFormat(buffer, size, length,
+                  ",\"freeHeap\":%u,\"minFreeHeap\":%u,\"maxFreeBlock\":%u,\"minMaxFreeBlock\":%u,"
+                  "\"heapFragmentation\":%u,\"maxHeapFragmentation\":%u,\"heapHistory\":",
+                  snapshot.freeHeap, snapshot.minFreeHeap, snapshot.maxFreeBlock, snapshot.minMaxFreeBlock,
+                  snapshot.heapFragmentation, snapshot.maxHeapFragmentation);
+  length = appendHistogram(buffer, size, length, snapshot.heapHistory);
+  return appendFormat(buffer, size, length, "}");
+}
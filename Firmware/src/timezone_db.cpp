@@ -0,0 +1,342 @@
+#include "timezone_db.h"
+
+#include <ESP8266WiFi.h>
+#include <WiFiClient.h>
+
+// the API key is only needed if the timezone info is queried from the API
+#if __has_include("config.h")
+#include "config.h"
+#endif
+#ifndef TZDB_API_KEY
+#define TZDB_API_KEY ""
+#endif
+
+// enable uint64 support for UNIX timestamps
+// and avoid the Y2038 problem
+#define ARDUINOJSON_USE_LONG_LONG 1
+#include <ArduinoJson.h>
+
+// disable debug messages to the serial port
+#undef DEBUG
+
+const char *timezoneDbHost = "api.timezonedb.com";
+const uint16_t timezoneDbPort = 80;
+// API Key is defined in include/config.h
+// which is ignored by git to keep the key private
+const char *timezoneDbPath = "/v2.1/get-time-zone?format=json&key=" TZDB_API_KEY "&by=zone&zone=";
+
+// of the 13 objects of a normal response from the timezonedb only the 3 fields
+// are kept, plus the copies of their keys and the dst string read from the stream
+const int responseCapacity = JSON_OBJECT_SIZE(3) + 32;
+
+// size of the filter selecting the fields of the response
+const int filterCapacity = JSON_OBJECT_SIZE(3);
+
+// the maximum time to wait for the rest of the body once it started to arrive
+const uint32_t parseTimeoutMs = 500;
+
+// the maximum time to wait for the TCP connection to be established
+const uint32_t connectTimeoutMs = 2000;
+
+// the maximum time a query may take from start to the parsed response
+const uint32_t fetchTimeoutMs = 10000;
+
+// the states of the query
+enum class TzFetchState
+{
+  Idle,
+  Connect,
+  Send,
+  ReceiveHeaders,
+  ReceiveBody,
+};
+
+static TzFetchState state = TzFetchState::Idle;
+static WiFiClient client;
+
+// the zone of the running query, as long as the timezoneName of the config,
+// percent-encoded for the query string (up to 3 characters per character)
+static char queriedZone[3 * 47 + 1];
+
+// the request, formatted in place. The networking path allocates nothing
+// on the heap, a clock running for months would fragment it
+static char request[320];
+
+// millis() when the running query was started
+static uint32_t startedAt;
+
+// the header line currently received
+static char headerLine[64];
+static size_t headerLineLength;
+
+// true once the status line of the response was received
+static bool statusReceived;
+
+/**
+ * @brief end the running query
+ *
+ * @return the passed result for convenience
+ */
+static TzFetchResult finish(TzFetchResult result)
+{
+  client.stop();
+  state = TzFetchState::Idle;
+  return result;
+}
+
+/**
+ * @brief check a received header line
+ *
+ * @return false if the line is the status line and the status is not 200 OK
+ */
+static bool handleHeaderLine()
+{
+  if (statusReceived)
+  {
+    return true;
+  }
+  statusReceived = true;
+
+  // status line: HTTP/1.x 200 OK
+  const char *status = strchr(headerLine, ' ');
+  return status != nullptr && strncmp(status + 1, "200", 3) == 0;
+}
+
+/**
+ * @brief parse the response body straight from the client
+ *
+ * Only the dst, gmtOffset and zoneEnd fields are kept, so neither the
+ * body nor the other fields of the response are ever stored
+ *
+ * @param[out] out the struct to write the timezone data to, only written
+ * if the body contained valid timezone data
+ * @return true if the body contained valid timezone data
+ */
+static bool parseBody(TzInfo *out)
+{
+  StaticJsonDocument<filterCapacity> filter;
+  filter["dst"] = true;
+  filter["gmtOffset"] = true;
+  filter["zoneEnd"] = true;
+
+  // the body is short and usually arrives in a single segment,
+  // but don't block for too long if it doesn't
+  client.setTimeout(parseTimeoutMs);
+
+  // parse the request response payload
+  StaticJsonDocument<responseCapacity> document;
+  DeserializationError error = deserializeJson(document, client, DeserializationOption::Filter(filter));
+  if (error != DeserializationError::Ok)
+  {
+#ifdef DEBUG
+    Serial.print("Failed to parse the response: ");
+    Serial.println(error.c_str());
+#endif
+    return false;
+  }
+
+#ifdef DEBUG
+  Serial.println("Parsed JSON:");
+  serializeJson(document, Serial);
+  Serial.println();
+#endif
+
+  if (!document.containsKey("dst") || !document.containsKey("gmtOffset") || !document.containsKey("zoneEnd"))
+  {
+    return false;
+  }
+
+  TzInfo parsed;
+
+  // dst is a string, not a boolean
+  // convert it to a boolean by string comparison
+  const char *dst = document["dst"];
+  parsed.dstInEffect = dst != nullptr && strcmp(dst, "1") == 0;
+
+  // gmtOffset is specified in seconds
+  parsed.offset = document["gmtOffset"].as<int32_t>();
+
+  // get the validUntil as time_t(uint64_t) as this is the
+  // (potential) size of a UNIX timestamp
+  parsed.validUntil = document["zoneEnd"].as<time_t>();
+
+  // only swap the complete info
+  *out = parsed;
+  return true;
+}
+
+/**
+ * @brief percent-encode a value of the query string
+ *
+ * Everything but the unreserved characters and the '/' of the zone names is
+ * encoded, a '+' would be decoded to a space (Etc/GMT+1 -> Etc/GMT 1)
+ *
+ * @param[out] out the buffer for the null-terminated encoded value,
+ * the value is truncated at a whole character if it does not fit
+ */
+static void percentEncode(const char *value, char *out, size_t size)
+{
+  static const char hexDigits[] = "0123456789ABCDEF";
+  size_t length = 0;
+  for (; *value != '\0'; value++)
+  {
+    char c = *value;
+    if (isalnum(c) || strchr("-._~/", c))
+    {
+      if (length + 1 >= size)
+      {
+        break;
+      }
+      out[length++] = c;
+    }
+    else
+    {
+      if (length + 3 >= size)
+      {
+        break;
+      }
+      out[length++] = '%';
+      out[length++] = hexDigits[(uint8_t)c >> 4];
+      out[length++] = hexDigits[c & 0x0F];
+    }
+  }
+  out[length] = '\0';
+}
+
+void tzFetchStart(const char *zone)
+{
+  client.stop();
+
+  percentEncode(zone, queriedZone, sizeof(queriedZone));
+  startedAt = millis();
+  headerLineLength = 0;
+  statusReceived = false;
+  state = TzFetchState::Connect;
+}
+
+bool tzFetchRunning()
+{
+  return state != TzFetchState::Idle;
+}
+
+TzFetchResult tzFetchService(TzInfo *out, uint32_t budgetUs)
+{
+  uint32_t sliceStart = micros();
+
+  while (state != TzFetchState::Idle && micros() - sliceStart < budgetUs)
+  {
+    if (millis() - startedAt > fetchTimeoutMs)
+    {
+#ifdef DEBUG
+      Serial.println("Query to timezonedb.com timed out");
+#endif
+      return finish(TzFetchResult::Failed);
+    }
+
+    switch (state)
+    {
+    case TzFetchState::Connect:
+      if (WiFi.status() != WL_CONNECTED)
+      {
+        return finish(TzFetchResult::Failed);
+      }
+
+      // the WiFiClient has no non-blocking connect. Resolving the host
+      // and connecting is the only step that is bounded by a timeout
+      // instead of the budget
+      client.setTimeout(connectTimeoutMs);
+      if (!client.connect(timezoneDbHost, timezoneDbPort))
+      {
+#ifdef DEBUG
+        Serial.print("Failed to connect to ");
+        Serial.println(timezoneDbHost);
+#endif
+        return finish(TzFetchResult::Failed);
+      }
+      state = TzFetchState::Send;
+      break;
+
+    case TzFetchState::Send:
+    {
+      // HTTP/1.0 avoids a chunked response, the request is small
+      // enough to go into the TCP send buffer without blocking
+      int length = snprintf(request, sizeof(request), "GET %s%s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                            timezoneDbPath, queriedZone, timezoneDbHost);
+      if (length < 0 || (size_t)length >= sizeof(request))
+      {
+        return finish(TzFetchResult::Failed);
+      }
+      client.write((const uint8_t *)request, length);
+      state = TzFetchState::ReceiveHeaders;
+      break;
+    }
+
+    case TzFetchState::ReceiveHeaders:
+    {
+      if (!client.available())
+      {
+        if (!client.connected())
+        {
+          return finish(TzFetchResult::Failed);
+        }
+        // nothing to do until more data arrives
+        return TzFetchResult::Pending;
+      }
+
+      char c = client.read();
+      if (c == '\r')
+      {
+        break;
+      }
+      if (c != '\n')
+      {
+        // truncate overlong header lines, only the status line is of interest
+        if (headerLineLength < sizeof(headerLine) - 1)
+        {
+          headerLine[headerLineLength++] = c;
+        }
+        break;
+      }
+
+      // an empty line ends the headers
+      if (headerLineLength == 0)
+      {
+        state = TzFetchState::ReceiveBody;
+        break;
+      }
+
+      headerLine[headerLineLength] = '\0';
+      headerLineLength = 0;
+      if (!handleHeaderLine())
+      {
+#ifdef DEBUG
+        Serial.print("GET failed for zone ");
+        Serial.print(queriedZone);
+        Serial.print(": ");
+        Serial.println(headerLine);
+#endif
+        return finish(TzFetchResult::Failed);
+      }
+      break;
+    }
+
+    case TzFetchState::ReceiveBody:
+      if (!client.available())
+      {
+        if (!client.connected())
+        {
+          return finish(TzFetchResult::Failed);
+        }
+        return TzFetchResult::Pending;
+      }
+
+      // parse as soon as the body starts to arrive
+      return finish(parseBody(out) ? TzFetchResult::Succeeded : TzFetchResult::Failed);
+
+    case TzFetchState::Idle:
+      break;
+    }
+  }
+
+  return tzFetchRunning() ? TzFetchResult::Pending : TzFetchResult::Failed;
+}
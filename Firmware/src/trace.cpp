@@ -0,0 +1,108 @@
+#include "trace.h"
+
+#include <stdio.h>
+
+#include "persistence.h"
+
+// the RTC user memory as mapped by the SDK (block 0 of ESP.rtcUserMemoryRead()).
+// The events are stored with plain stores instead of the SDK calls
+static volatile uint32_t *const rtcUserMemory = (volatile uint32_t *)0x60001200;
+
+// the trace takes the blocks after the time saved by the persistence up to
+// the end of the 512 bytes: a header of 4 blocks and 2 blocks per event
+const uint8_t traceHeaderBlock = rtcTimeBlock + rtcTimeBlocks;
+const uint8_t traceFirstBlock = traceHeaderBlock + 4;
+static_assert(traceFirstBlock + 2 * traceCapacity <= 128, "the trace does not fit the RTC user memory");
+
+// marks a valid trace, changed whenever the layout changes
+const uint32_t traceMagic = 0x4E585452;
+
+// the header: the magic, the slot of the next event, the number of
+// events (up to the capacity) and the number of boots
+const uint8_t magicBlock = traceHeaderBlock;
+const uint8_t nextBlock = traceHeaderBlock + 1;
+const uint8_t countBlock = traceHeaderBlock + 2;
+const uint8_t bootBlock = traceHeaderBlock + 3;
+
+// the copies of the header and the time of the events, kept in RAM so
+// tracing an event only stores to the RTC memory
+static uint8_t next = 0;
+static uint8_t count = 0;
+static uint8_t boot = 0;
+static uint32_t currentUtc = 0;
+
+// the names of the events in the JSON, by the value of the TraceEvent
+static const char *eventNames[] = {"unknown", "boot", "networkUp", "ntpSync", "phaseMeasured",
+                                   "tzFetchSucceeded", "tzFetchFailed", "wifiReconnect", "reboot",
+                                   "loopStall", "fleetRole", "otaStart", "otaError", "configSaved"};
+
+void traceBegin(uint32_t resetReason)
+{
+  // the RTC memory holds garbage after a power-on
+  if (rtcUserMemory[magicBlock] != traceMagic || rtcUserMemory[nextBlock] >= traceCapacity ||
+      rtcUserMemory[countBlock] > traceCapacity)
+  {
+    rtcUserMemory[nextBlock] = 0;
+    rtcUserMemory[countBlock] = 0;
+    rtcUserMemory[bootBlock] = 0;
+    rtcUserMemory[magicBlock] = traceMagic;
+  }
+
+  next = rtcUserMemory[nextBlock];
+  count = rtcUserMemory[countBlock];
+  boot = rtcUserMemory[bootBlock] + 1;
+  rtcUserMemory[bootBlock] = boot;
+  trace(TraceEvent::Boot, resetReason);
+}
+
+void traceSetTime(time_t utc)
+{
+  currentUtc = utc;
+}
+
+void trace(TraceEvent event, uint16_t arg)
+{
+  // the event first, a reset in between only loses this event
+  uint8_t block = traceFirstBlock + 2 * next;
+  rtcUserMemory[block] = currentUtc;
+  rtcUserMemory[block + 1] = (uint32_t)event | (uint32_t)boot << 8 | (uint32_t)arg << 16;
+
+  next = next + 1 == traceCapacity ? 0 : next + 1;
+  rtcUserMemory[nextBlock] = next;
+  if (count < traceCapacity)
+  {
+    rtcUserMemory[countBlock] = ++count;
+  }
+}
+
+uint8_t traceCount()
+{
+  return count;
+}
+
+bool traceRead(uint8_t index, TraceRecord *out)
+{
+  if (index >= count)
+  {
+    return false;
+  }
+
+  // the oldest event is the next one to be overwritten once the ring is full
+  uint8_t slot = (count == traceCapacity ? next + index : index) % traceCapacity;
+  uint8_t block = traceFirstBlock + 2 * slot;
+  uint32_t packed = rtcUserMemory[block + 1];
+  out->utc = rtcUserMemory[block];
+  out->event = (TraceEvent)(packed & 0xFF);
+  out->boot = packed >> 8;
+  out->arg = packed >> 16;
+  return true;
+}
+
+size_t formatTraceRecord(const TraceRecord &record, char *buffer, size_t size)
+{
+  uint8_t event = (uint8_t)record.event;
+  const char *name = event < sizeof(eventNames) / sizeof(eventNames[0]) ? eventNames[event] : eventNames[0];
+  int length = snprintf(buffer, size, "{\"utc\":%u,\"boot\":%u,\"event\":\"%s\",\"arg\":%u}", record.utc, record.boot,
+                        name, record.arg);
+  return max(length, 0);
+}
\ No newline at end of file
@@ -0,0 +1,320 @@
+#include "tz_rule.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+const int32_t secondsPerMinute = 60;
+const int32_t secondsPerHour = 60 * secondsPerMinute;
+const int32_t secondsPerDay = 24 * secondsPerHour;
+
+// transitions happen at 02:00:00 local time if not specified otherwise
+const int32_t defaultTransitionTime = 2 * secondsPerHour;
+
+/**
+ * @brief days since 1970-01-01 of a date in the proleptic gregorian calendar
+ */
+static int32_t daysFromCivil(int32_t year, uint8_t month, uint8_t day)
+{
+  year -= month <= 2;
+  const int32_t era = (year >= 0 ? year : year - 399) / 400;
+  const int32_t yearOfEra = year - era * 400;
+  const int32_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const int32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + dayOfEra - 719468;
+}
+
+/**
+ * @brief the year of a day since 1970-01-01
+ */
+static int32_t yearFromDays(int32_t days)
+{
+  days += 719468;
+  const int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const int32_t dayOfEra = days - era * 146097;
+  const int32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  const int32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  const int32_t monthIndex = (5 * dayOfYear + 2) / 153;
+  return yearOfEra + era * 400 + (monthIndex >= 10);
+}
+
+static bool isLeapYear(int32_t year)
+{
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static uint8_t daysInMonth(int32_t year, uint8_t month)
+{
+  static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  return month == 2 && isLeapYear(year) ? 29 : days[month - 1];
+}
+
+/**
+ * @brief parse an unsigned number
+ *
+ * @return false if there is no number at the current position
+ */
+static bool parseNumber(const char *&posix, int32_t *out)
+{
+  if (!isdigit((unsigned char)*posix))
+  {
+    return false;
+  }
+
+  *out = 0;
+  while (isdigit((unsigned char)*posix))
+  {
+    *out = *out * 10 + (*posix++ - '0');
+  }
+  return true;
+}
+
+/**
+ * @brief parse a time in the format [+|-]hh[:mm[:ss]]
+ *
+ * @param[out] out the time in seconds
+ */
+static bool parseTime(const char *&posix, int32_t *out)
+{
+  int32_t sign = 1;
+  if (*posix == '+' || *posix == '-')
+  {
+    sign = *posix++ == '-' ? -1 : 1;
+  }
+
+  int32_t hours;
+  if (!parseNumber(posix, &hours))
+  {
+    return false;
+  }
+  *out = hours * secondsPerHour;
+
+  int32_t minutes;
+  if (*posix == ':')
+  {
+    posix++;
+    if (!parseNumber(posix, &minutes))
+    {
+      return false;
+    }
+    *out += minutes * secondsPerMinute;
+
+    int32_t seconds;
+    if (*posix == ':')
+    {
+      posix++;
+      if (!parseNumber(posix, &seconds))
+      {
+        return false;
+      }
+      *out += seconds;
+    }
+  }
+
+  *out *= sign;
+  return true;
+}
+
+/**
+ * @brief skip the name of a zone: at least 3 letters or any <quoted> text
+ */
+static bool skipName(const char *&posix)
+{
+  const char *begin = posix;
+  if (*posix == '<')
+  {
+    while (*posix && *posix != '>')
+    {
+      posix++;
+    }
+    if (*posix != '>')
+    {
+      return false;
+    }
+    posix++;
+    // the quoted name must not be empty
+    return posix - begin > 2;
+  }
+
+  while (isalpha((unsigned char)*posix))
+  {
+    posix++;
+  }
+  return posix - begin >= 3;
+}
+
+/**
+ * @brief parse the rule of a transition in the format date[/time]
+ */
+static bool parseTransitionRule(const char *&posix, TzTransitionRule *out)
+{
+  int32_t value;
+  if (*posix == 'M')
+  {
+    posix++;
+    int32_t week, weekday;
+    if (!parseNumber(posix, &value) || *posix++ != '.' || !parseNumber(posix, &week) || *posix++ != '.' || !parseNumber(posix, &weekday))
+    {
+      return false;
+    }
+    if (value < 1 || value > 12 || week < 1 || week > 5 || weekday > 6)
+    {
+      return false;
+    }
+    out->type = 'M';
+    out->day = value;
+    out->week = week;
+    out->weekday = weekday;
+  }
+  else
+  {
+    out->type = 'D';
+    if (*posix == 'J')
+    {
+      out->type = 'J';
+      posix++;
+    }
+    if (!parseNumber(posix, &value) || value > 365 || (out->type == 'J' && value < 1))
+    {
+      return false;
+    }
+    out->day = value;
+  }
+
+  out->time = defaultTransitionTime;
+  if (*posix == '/')
+  {
+    posix++;
+    return parseTime(posix, &out->time);
+  }
+  return true;
+}
+
+/**
+ * @brief the local time of a transition in a year as seconds since 1970-01-01
+ */
+static int64_t transitionLocalTime(const TzTransitionRule &rule, int32_t year)
+{
+  int32_t days = daysFromCivil(year, 1, 1);
+  switch (rule.type)
+  {
+  case 'J':
+    // February 29th is never counted
+    days += rule.day - 1 + (isLeapYear(year) && rule.day > 59 ? 1 : 0);
+    break;
+
+  case 'D':
+    days += rule.day;
+    break;
+
+  case 'M':
+  {
+    int32_t firstOfMonth = daysFromCivil(year, rule.day, 1);
+    // 1970-01-01 was a thursday
+    int32_t firstWeekday = ((firstOfMonth + 4) % 7 + 7) % 7;
+    int32_t dayOfMonth = 1 + (rule.weekday - firstWeekday + 7) % 7 + (rule.week - 1) * 7;
+    // week 5 means the last week of the month
+    while (dayOfMonth > daysInMonth(year, rule.day))
+    {
+      dayOfMonth -= 7;
+    }
+    days = firstOfMonth + dayOfMonth - 1;
+    break;
+  }
+  }
+
+  return (int64_t)days * secondsPerDay + rule.time;
+}
+
+bool parseTzRule(const char *posix, TzRule *out)
+{
+  TzRule rule;
+
+  // the offsets in the TZ string are west positive
+  int32_t offset;
+  if (!skipName(posix) || !parseTime(posix, &offset))
+  {
+    return false;
+  }
+  rule.stdOffset = -offset;
+  rule.hasDst = false;
+
+  if (*posix)
+  {
+    if (!skipName(posix))
+    {
+      return false;
+    }
+    rule.hasDst = true;
+
+    // DST is one hour ahead of standard time if not specified otherwise
+    rule.dstOffset = rule.stdOffset + secondsPerHour;
+    if (*posix && *posix != ',')
+    {
+      if (!parseTime(posix, &offset))
+      {
+        return false;
+      }
+      rule.dstOffset = -offset;
+    }
+
+    // the rules are not optional, there is no sensible default for all zones
+    if (*posix++ != ',' || !parseTransitionRule(posix, &rule.start) ||
+        *posix++ != ',' || !parseTransitionRule(posix, &rule.end) || *posix)
+    {
+      return false;
+    }
+  }
+
+  *out = rule;
+  return true;
+}
+
+void getTzRuleInfo(const TzRule &rule, time_t utc, TzInfo *out)
+{
+  if (!rule.hasDst)
+  {
+    out->dstInEffect = false;
+    out->offset = rule.stdOffset;
+    out->validUntil = utc + 365 * secondsPerDay;
+    return;
+  }
+
+  // the year is determined from the standard time, the transitions of the
+  // years around it always contain the last and the next transition
+  int32_t year = yearFromDays((int32_t)(((int64_t)utc + rule.stdOffset) / secondsPerDay));
+
+  // the last transition before now decides the current state
+  bool dstInEffect = false;
+  int64_t lastTransition = INT64_MIN;
+  int64_t nextTransition = INT64_MAX;
+  for (int32_t y = year - 1; y <= year + 1; y++)
+  {
+    // the start is specified in standard time, the end in DST
+    int64_t start = transitionLocalTime(rule.start, y) - rule.stdOffset;
+    int64_t end = transitionLocalTime(rule.end, y) - rule.dstOffset;
+
+    if (start <= utc && start > lastTransition)
+    {
+      lastTransition = start;
+      dstInEffect = true;
+    }
+    if (end <= utc && end > lastTransition)
+    {
+      lastTransition = end;
+      dstInEffect = false;
+    }
+
+    if (start > utc && start < nextTransition)
+    {
+      nextTransition = start;
+    }
+    if (end > utc && end < nextTransition)
+    {
+      nextTransition = end;
+    }
+  }
+
+  out->dstInEffect = dstInEffect;
+  out->offset = dstInEffect ? rule.dstOffset : rule.stdOffset;
+  out->validUntil = (time_t)nextTransition;
+}
\ No newline at end of file